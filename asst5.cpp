@@ -16,7 +16,16 @@
 #include "glmutils.h"
 #include "geometrymaker.h"
 #include "geometry.h"
+#include "meshoptimizer.h"
+#include "meshfile.h"
+#include "objimporter.h"
 #include "material.h"
+#include "textureloader.h"
+#include "uniformblock.h"
+#include "renderqueue.h"
+#include "bvh.h"
+#include "transformbatch.h"
+#include "pickmesh.h"
 
 #include "ppm.h"
 #include "glsupport.h"
@@ -44,16 +53,29 @@ static double g_mouseClickX, g_mouseClickY; // coordinates for mouse click event
 static int g_activeShader = 0;
 
 static int g_ms_between_keyframes = 2000;
-static int g_animate_fps = 30;
+static int g_animate_fps = 120;        // upper bound on the playback frame rate, when vsync does not pace frames
 static float g_anim_time = 0.0f;
 static bool g_animation_on = false;
 
+// Frames are only rendered when what the window shows changed: set by input,
+// script edits, playback, texture uploads and window damage
+static bool g_redisplay = true;
+
 // --------- Shaders
 
 static shared_ptr<Material> g_cubeDiffuseMat[2],
 g_bumpFloorMat,
 g_arcballMat;
 
+// Uniforms shared by all draws of a frame: projection and lights
+static shared_ptr<UniformBlock> g_frameBlock;
+
+// Draws of a frame, sorted to minimize state changes before being submitted
+static RenderQueue g_renderQueue;
+
+// State changes sent to GL and skipped as redundant by GlStateCache in the last frame
+static unsigned long g_frameGlCallsIssued, g_frameGlCallsSkipped;
+
 
 // --------- Geometry
 
@@ -68,13 +90,38 @@ static std::shared_ptr<Script> g_script;
 // --------- Scene
 
 static const glm::vec3 g_light1(2.0, 3.0, 14.0), g_light2(-2, -3.0, -5.0); // define two lights positions in world space
-static glm::mat4 g_skyRbt = glm::translate(glm::vec3(0.0, 0.25, 4.0));
-static glm::mat4 g_objectRbt[2] = { glm::translate(glm::vec3(-1.0f, 0, 0)),
-                                    glm::translate(glm::vec3(1.0f, 0, 0)) };
+static Rbt g_skyRbt = Rbt(glm::vec3(0.0, 0.25, 4.0));
+static Rbt g_objectRbt[2] = { Rbt(glm::vec3(-1.0f, 0, 0)),
+                              Rbt(glm::vec3(1.0f, 0, 0)) };
 static glm::vec3 g_objectColors[2] = { glm::vec3(1, 0, 0),
                                        glm::vec3(0, 0, 1) };
-static glm::mat4 g_ballRbt = glm::translate(glm::vec3(0.f, 0.0f, 0.f));
+static Rbt g_ballRbt = Rbt(glm::vec3(0.f, 0.0f, 0.f));
 static glm::vec3 g_ballColor(0.2f, 0.8f, 0.3f);  //  greenish
+static const Rbt g_groundRbt = Rbt(glm::vec3(0.0f, g_groundY, 0.0f));
+
+// Objects drawn by drawStuff, culled against the view frustum through a
+// bounding volume hierarchy over their world space bounds. The arcball is
+// not part of them, and always drawn.
+struct SceneObject {
+    shared_ptr<Geometry> geometry;
+    shared_ptr<Material> material;
+    const Rbt *rbt;
+    int lodLevel;   // level of detail of the geometry drawn last
+    int activeObjectId;   // g_activeObject value manipulating the object, -1 if it cannot be
+};
+
+static vector<SceneObject> g_sceneObjects;
+static Bvh g_sceneBvh;
+static TransformBatch g_sceneTransforms;   // matrices of g_sceneObjects, for the current frame
+static vector<int> g_visibleObjects;  // indices into g_sceneObjects, for the current frame
+
+// World space bounds of an object, unbounded if its geometry does not know its bounds
+static Aabb getWorldBounds(const SceneObject& object) {
+    const Aabb& bounds = object.geometry->getBounds();
+    if (bounds.isEmpty())
+        return Aabb(glm::vec3(-FLT_MAX), glm::vec3(FLT_MAX));
+    return bounds.transformed(object.rbt->toMatrix());
+}
 
 // --------- User interface variables
 
@@ -92,16 +139,29 @@ static float g_arcballScale = 1.0f / g_arcballScreenRadius;
 ///////////////// END OF G L O B A L S //////////////////////////////////////////////////
 
 
+// Optimizes a mesh made by geometrymaker.h for the vertex cache and vertex
+// fetches, and reports the gain. Vertices are stored packed, in 24 bytes each
+static shared_ptr<Geometry> makeOptimizedGeometry(const char *name, vector<VertexPackedPNTX>& vtx, vector<unsigned int>& idx) {
+    const MeshOptimizerStats stats = optimizeMesh(vtx, idx);
+    shared_ptr<IndexedGeometryPackedPNTX> geometry(new IndexedGeometryPackedPNTX(&vtx[0], &idx[0], vtx.size(), idx.size()));
+    geometry->setPickMesh(PickMesh::create(&vtx[0], vtx.size(), &idx[0], idx.size()));
+
+    const GLenum format = geometry->getIndexFormat();
+    cout << name << ": " << stats.numVerticesAfter << " vertices, ACMR " << stats.acmrBefore << " -> " << stats.acmrAfter
+         << ", " << (format == GL_UNSIGNED_BYTE ? 8 : format == GL_UNSIGNED_SHORT ? 16 : 32) << "-bit indices" << endl;
+    return geometry;
+}
+
 static void initGround() {
     int ibLen, vbLen;
     getPlaneVbIbLen(vbLen, ibLen);
 
     // Temporary storage for cube Geometry
-    vector<VertexPNTBX> vtx(vbLen);
-    vector<unsigned short> idx(ibLen);
+    vector<VertexPackedPNTX> vtx(vbLen);
+    vector<unsigned int> idx(ibLen);
 
     makePlane(g_groundSize * 2, vtx.begin(), idx.begin());
-    g_ground.reset(new SimpleIndexedGeometryPNTBX(&vtx[0], &idx[0], vbLen, ibLen));
+    g_ground = makeOptimizedGeometry("Ground", vtx, idx);
 }
 
 static void initCubes() {
@@ -109,27 +169,29 @@ static void initCubes() {
     getCubeVbIbLen(vbLen, ibLen);
 
     // Temporary storage for cube Geometry
-    vector<VertexPNTBX> vtx(vbLen);
-    vector<unsigned short> idx(ibLen);
+    vector<VertexPackedPNTX> vtx(vbLen);
+    vector<unsigned int> idx(ibLen);
 
     makeCube(1, vtx.begin(), idx.begin());
-    g_cube.reset(new SimpleIndexedGeometryPNTBX(&vtx[0], &idx[0], vbLen, ibLen));
+    g_cube = makeOptimizedGeometry("Cube", vtx, idx);
 }
 
+// The arcball is always drawn at g_arcballScreenRadius, so a single level of
+// detail is enough
 static void initSphere() {
     int ibLen, vbLen;
     getSphereVbIbLen(20, 10, vbLen, ibLen);
 
     // Temporary storage for sphere Geometry
-    vector<VertexPNTBX> vtx(vbLen);
-    vector<unsigned short> idx(ibLen);
+    vector<VertexPackedPNTX> vtx(vbLen);
+    vector<unsigned int> idx(ibLen);
     makeSphere(1, 20, 10, vtx.begin(), idx.begin());
-    g_sphere.reset(new SimpleIndexedGeometryPNTBX(&vtx[0], &idx[0], vtx.size(), idx.size()));
+    g_sphere = makeOptimizedGeometry("Sphere", vtx, idx);
 }
 
 void initAnimation()
 {
-    std::vector<glm::mat4*> object_ptrs;          // pointers to objects in scene
+    std::vector<Rbt*> object_ptrs;                // pointers to objects in scene
     object_ptrs.push_back(&g_skyRbt);
     object_ptrs.push_back(&g_objectRbt[0]);
     object_ptrs.push_back(&g_objectRbt[1]);
@@ -162,14 +224,21 @@ static bool z_translating(void)
 }
 
 
+// uniform names set every frame, interned once
+static const UniformName g_uProjMatrix("uProjMatrix");
+static const UniformName g_uModelViewMatrix("uModelViewMatrix");
+static const UniformName g_uNormalMatrix("uNormalMatrix");
+static const UniformName g_uLight("uLight");
+static const UniformName g_uLight2("uLight2");
+
 // takes a projection matrix and send to the the shaders
-inline void sendProjectionMatrix(Uniforms& uniforms, const glm::mat4& projMatrix) {
-    uniforms.put("uProjMatrix", projMatrix);
+inline void sendProjectionMatrix(UniformBlock& frameBlock, const glm::mat4& projMatrix) {
+    frameBlock.put(g_uProjMatrix, projMatrix);
 }
 
 // takes MVM and its normal matrix to the shaders
 inline void sendModelViewNormalMatrix(Uniforms& uniforms, const glm::mat4& MVM, const glm::mat4& NMVM) {
-    uniforms.put("uModelViewMatrix", MVM).put("uNormalMatrix", NMVM);
+    uniforms.put(g_uModelViewMatrix, MVM).put(g_uNormalMatrix, NMVM);
 }
 
 // update g_frustFovY from g_frustMinFov, g_windowWidth, and g_windowHeight
@@ -192,6 +261,23 @@ static glm::mat4 makeProjectionMatrix()
 }
 
 
+// Diameter in pixels of the bounding sphere of object space `bounds', seen
+// through the model view matrix MVM. Unbounded objects, and objects around
+// the eye, are as large as possible. The sphere encloses the whole box, so
+// round objects are overestimated by up to sqrt(3), which errs towards the
+// finer levels of detail.
+static float getScreenSize(const Aabb& bounds, const glm::mat4& MVM)
+{
+    if (bounds.isEmpty())
+        return FLT_MAX;
+    const float scale = std::max(glm::length(glm::vec3(MVM[0])), std::max(glm::length(glm::vec3(MVM[1])), glm::length(glm::vec3(MVM[2]))));
+    const float radius = glm::length(bounds.getExtent()) * scale;
+    const float z = (MVM * glm::vec4(bounds.getCenter(), 1)).z;
+    if (z > -radius - 1e-3f)
+        return FLT_MAX;
+    return 2 * radius / getScreenToEyeScale(z, g_frustFovY, g_windowHeight);
+}
+
 static void drawStuff() {
 
     // Declare an empty uniforms
@@ -200,52 +286,54 @@ static void drawStuff() {
     // Get your projection matrix into proj mat as usual
     const glm::mat4 projmat = makeProjectionMatrix();
 
-        // send proj. matrix to be stored by uniforms,
+        // send proj. matrix to be stored by the per-frame block,
         // as opposed to the current vtx shader
-        sendProjectionMatrix(uniforms, projmat);
+        sendProjectionMatrix(*g_frameBlock, projmat);
 
 
     // get your eyeRbt, invEyeRbt and stuff as usual
-        const glm::mat4 eyeRbt = (g_currentView == 0) ? g_skyRbt : g_objectRbt[g_currentView - 1];
-        const glm::mat4 invEyeRbt = glm::inverse(eyeRbt);
+        const Rbt eyeRbt = (g_currentView == 0) ? g_skyRbt : g_objectRbt[g_currentView - 1];
+        const Rbt invEyeRbt = inv(eyeRbt);
 
         // get the eye space coordinates of the two light as usual
         // suppose they are stored as Cvec3 eyeLight1 and eyeLight2
 
-        const glm::vec3 eyeLight1 = glm::vec3(invEyeRbt * glm::vec4(g_light1, 1)); // g_light1 position in eye coordinates
-        const glm::vec3 eyeLight2 = glm::vec3(invEyeRbt * glm::vec4(g_light2, 1)); // g_light2 position in eye coordinates
-
-        // send the eye space coordinates of lights to uniforms
-        uniforms.put("uLight", eyeLight1);
-        uniforms.put("uLight2", eyeLight2);
+        const glm::vec3 eyeLight1 = invEyeRbt.transformPoint(g_light1); // g_light1 position in eye coordinates
+        const glm::vec3 eyeLight2 = invEyeRbt.transformPoint(g_light2); // g_light2 position in eye coordinates
 
+        // send the eye space coordinates of lights to the per-frame block,
+        // uploaded once here for all draws below
+        g_frameBlock->put(g_uLight, eyeLight1);
+        g_frameBlock->put(g_uLight2, eyeLight2);
+        g_frameBlock->bind();
 
-    // For draw ground
-    // ---------------
-    // set the ground object frame 
-    const glm::mat4 groundRbt = glm::translate(glm::vec3(0.0f, g_groundY, 0.0f));
-    glm::mat4 MVM = invEyeRbt * groundRbt;
-    glm::mat4 NMVM = normalMatrix(MVM);
 
-        // Use uniforms as opposed to curSS
-        sendModelViewNormalMatrix(uniforms, MVM, NMVM);
+    // Refit the scene hierarchy to where animation and manipulation moved the
+    // objects, and compute all their matrices in one pass
+    for (size_t i = 0; i < g_sceneObjects.size(); ++i) {
+        g_sceneBvh.setBounds(i, getWorldBounds(g_sceneObjects[i]));
+        g_sceneTransforms.setRbt(i, *g_sceneObjects[i].rbt);
+    }
+    g_sceneBvh.refit();
+    g_sceneTransforms.compute(invEyeRbt);
 
-    // draw ground geometry with its shader
-    g_bumpFloorMat->draw(*g_ground, uniforms);
+    // and draw those in the view frustum
 
+    g_visibleObjects.clear();
+    g_sceneBvh.cull(Frustum(projmat * invEyeRbt.toMatrix()), g_visibleObjects);
 
-    // For draw cubes:
-    // ---------------
-    for (int i = 0; i < 2; i++)
+    glm::mat4 MVM, NMVM;
+    for (size_t i = 0; i < g_visibleObjects.size(); ++i)
     {
-        MVM = invEyeRbt * g_objectRbt[i];
-        NMVM = normalMatrix(MVM);
+        SceneObject& object = g_sceneObjects[g_visibleObjects[i]];
+        const glm::mat4& objectMVM = g_sceneTransforms.getModelViewMatrix(g_visibleObjects[i]);
 
             // Use uniforms as opposed to curSS
-            sendModelViewNormalMatrix(uniforms, MVM, NMVM);
+            sendModelViewNormalMatrix(uniforms, objectMVM, g_sceneTransforms.getNormalMatrix(g_visibleObjects[i]));
 
-        // draw cube with diffuse shader
-        g_cubeDiffuseMat[i]->draw(*g_cube, uniforms);
+        // the level of detail follows the size of the object on screen
+        object.lodLevel = object.geometry->selectLod(getScreenSize(object.geometry->getBounds(), objectMVM), object.lodLevel);
+        g_renderQueue.add(*object.material, object.geometry->getLod(object.lodLevel), uniforms, -objectMVM[3].z);
     }
 
 
@@ -254,23 +342,26 @@ static void drawStuff() {
     //----------------------
 
     // calculate arcball MVM as usual and store, say in, MVM
-    g_ballRbt = (g_activeObject == 0) ? glm::mat4(1.0f) : g_objectRbt[g_activeObject - 1];
+    g_ballRbt = (g_activeObject == 0) ? Rbt() : g_objectRbt[g_activeObject - 1];
     //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE); // draw wireframe
-    MVM = invEyeRbt * g_ballRbt;
+    const Rbt ballMVRbt = invEyeRbt * g_ballRbt;
     if (!z_translating())
-        g_arcballScale = getScreenToEyeScale(MVM[3].z, g_frustFovY, g_windowHeight);
-    MVM *= glm::scale(glm::vec3(g_arcballScale * g_arcballScreenRadius));
-    NMVM = normalMatrix(MVM);
+        g_arcballScale = getScreenToEyeScale(ballMVRbt.t.z, g_frustFovY, g_windowHeight);
+    MVM = ballMVRbt.toMatrix() * glm::scale(glm::vec3(g_arcballScale * g_arcballScreenRadius));
+    NMVM = normalMatrix(ballMVRbt);   // the uniform scale only changes the length of normals
 
         // Use uniforms as opposed to curSS
-        sendModelViewNormalMatrix(uniforms, MVM, normalMatrix(MVM));
+        sendModelViewNormalMatrix(uniforms, MVM, NMVM);
 
     // No more glPolygonMode calls
 
-    g_arcballMat->draw(*g_sphere, uniforms);
+    g_renderQueue.add(*g_arcballMat, *g_sphere, uniforms, -MVM[3].z);
 
     // No more glPolygonMode calls
 
+    // draw everything, opaque objects first and the arcball last
+    g_renderQueue.submit();
+
 }
 
 
@@ -281,6 +372,11 @@ static void display(GLFWwindow* window) {
 
     drawStuff();               // no more curSS
 
+    GlStateCache& gl = GlStateCache::getSingleton();
+    g_frameGlCallsIssued = gl.getNumIssued();
+    g_frameGlCallsSkipped = gl.getNumSkipped();
+    gl.resetCounters();
+
     glfwSwapBuffers(window);
 
     checkGlErrors();
@@ -301,9 +397,18 @@ static void reshape(GLFWwindow* window, const int w, const int h)
     display(window);
 }
 
-glm::mat4 doMtoOwrtA(const glm::mat4& M, const glm::mat4& O, const glm::mat4& A)
+// the window needs to be drawn again, e.g., after being uncovered
+static void refresh(GLFWwindow* window)
+{
+    g_redisplay = true;
+}
+
+Rbt doMtoOwrtA(const Rbt& M, const Rbt& O, const Rbt& A)
 {
-    return A * M * glm::inverse(A) * O;
+    // renormalize, so that rounding errors do not pile up over many mouse moves
+    Rbt result = A * M * inv(A) * O;
+    result.r = glm::normalize(result.r);
+    return result;
 }
 
 // Frame that we're manipulating the current object with respect to. This is:
@@ -313,7 +418,7 @@ glm::mat4 doMtoOwrtA(const glm::mat4& M, const glm::mat4& O, const glm::mat4& A)
 //     viable frames, and pressing 'm' switches between them:
 //      - World-sky frame (like orbiting around the world)
 //      - Sky-sky frame (like moving your head)
-static glm::mat4 setWrtFrame(int object, int view, int sky_pick)
+static Rbt setWrtFrame(int object, int view, int sky_pick)
 {
     if ((object != 0) && (view == 0))
         return transFact(g_objectRbt[object - 1]) * linFact(g_skyRbt);  // cube-sky frame
@@ -328,15 +433,20 @@ static glm::mat4 setWrtFrame(int object, int view, int sky_pick)
 }
 
 
-glm::mat4 getArcballRotation(float x, float y)
+// Screen space center of the arcball. It stays put while dragging: rotations
+// keep the ball center where it is, and the eye does not move relative to it.
+static glm::vec2 getArcballScreenCenter()
 {
-    const glm::mat4 eyeRbt = (g_currentView == 0) ? g_skyRbt : g_objectRbt[g_currentView - 1];
-    const glm::mat4 invEyeRbt = glm::inverse(eyeRbt);
-    const glm::mat4 MVM = invEyeRbt * g_ballRbt;
+    const Rbt eyeRbt = (g_currentView == 0) ? g_skyRbt : g_objectRbt[g_currentView - 1];
+    const Rbt invEyeRbt = inv(eyeRbt);
     const glm::mat4 projmat = makeProjectionMatrix();
-    const glm::vec3 ball_center = glm::vec3(MVM[3]);
-    const glm::vec2 sphere_center = getScreenSpaceCoord(ball_center, projmat, g_frustNear, g_frustFovY,
+    const glm::vec3 ball_center = invEyeRbt.transformPoint(g_ballRbt.t);
+    return getScreenSpaceCoord(ball_center, projmat, g_frustNear, g_frustFovY,
         g_windowWidth, g_windowHeight);
+}
+
+Rbt getArcballRotation(const glm::vec2& sphere_center, float x, float y)
+{
     const glm::vec2 p1 = glm::vec2(g_mouseClickX, g_mouseClickY) - sphere_center;
     const glm::vec2 p2 = glm::vec2(x, y) - sphere_center;
     const int r = g_arcballScreenRadius;
@@ -347,58 +457,156 @@ glm::mat4 getArcballRotation(float x, float y)
     glm::vec3 v2 = glm::vec3(p2, v2z);
 
     glm::quat q = glm::normalize(glm::quat(glm::dot(v1, v2), glm::cross(v1, v2)));   // unit quaternion
-    return glm::mat4_cast(q);
+    return Rbt(q);
 }
 
+// Cursor positions received since the last frame, applied at once by applyMotion()
+struct MotionEvent {
+    double x, y;    // GLFW window coordinates
+};
+
+static vector<MotionEvent> g_pendingMotion;
 
 static void motion(GLFWwindow* window, double x, double y)
 {
-    const float dx = x - g_mouseClickX;
-    const float dy = g_windowHeight - y - 1 - g_mouseClickY;
+    const MotionEvent e = { x, y };
+    g_pendingMotion.push_back(e);
+}
 
-    glm::mat4 m, A;
-    float translation_scale = arcball_in_use() ? g_arcballScale : 0.01f;  // screen coords to eye coords
+// Applies the cursor moves since the last call as one manipulation. The moves
+// of a batch are all of the same kind, since mouse() and keyboard() apply the
+// pending moves before changing the buttons and modes. Per move, only the
+// transformation m is computed, and they are composed in the order that gives
+// the same frame as applying each one in turn:
+//   - when the eye is the active object, the wrt frame A turns along with it,
+//     and A * m1 * inv(A) then A' * m2 * inv(A') amounts to A * (m1 * m2) * inv(A)
+//   - otherwise A stays put (rotations are about the object center, and
+//     translations do not depend on A's origin), giving A * (m2 * m1) * inv(A)
+static void applyMotion()
+{
+    if (g_pendingMotion.empty())
+        return;
 
-    // generate the affine transformation m
-    if (g_mouseLClickButton && !g_mouseRClickButton && !g_spaceDown) // left button down?
-    {
-        if (arcball_in_use())
-            m = getArcballRotation(x, g_windowHeight - y - 1);
-        else
-            m = glm::rotate(glm::radians(-dy), glm::vec3(1, 0, 0)) * glm::rotate(glm::radians(dx), glm::vec3(0, 1, 0));
-    }
-    else if (g_mouseRClickButton && !g_mouseLClickButton) // right button down?
+    if (!g_mouseClickDown)
     {
-        m = glm::translate(glm::vec3(dx, dy, 0.0f) * translation_scale);
+        const MotionEvent& last = g_pendingMotion.back();
+        g_mouseClickX = last.x;
+        g_mouseClickY = g_windowHeight - last.y - 1;
+        g_pendingMotion.clear();
+        return;
     }
-    else if (g_mouseMClickButton ||
-        (g_mouseLClickButton && g_mouseRClickButton) ||
-        (g_mouseLClickButton && !g_mouseRClickButton && g_spaceDown)) // middle or (left and right), or (left + space) button down?
+
+    const bool arcball = arcball_in_use();
+    const bool eyeIsActive = g_activeObject == g_currentView;
+    const float translation_scale = arcball ? g_arcballScale : 0.01f;  // screen coords to eye coords
+    const glm::vec2 sphere_center = arcball ? getArcballScreenCenter() : glm::vec2(0.0f);
+
+    Rbt composed;
+    for (size_t i = 0; i < g_pendingMotion.size(); ++i)
     {
-        m = glm::translate(glm::vec3(0, 0, -dy) * translation_scale);
+        const double x = g_pendingMotion[i].x, y = g_windowHeight - g_pendingMotion[i].y - 1;
+        const float dx = x - g_mouseClickX;
+        const float dy = y - g_mouseClickY;
+
+        // generate the affine transformation m
+        Rbt m;
+        if (g_mouseLClickButton && !g_mouseRClickButton && !g_spaceDown) // left button down?
+        {
+            if (arcball)
+                m = getArcballRotation(sphere_center, x, y);
+            else
+                m = Rbt(glm::angleAxis(glm::radians(-dy), glm::vec3(1, 0, 0)) * glm::angleAxis(glm::radians(dx), glm::vec3(0, 1, 0)));
+        }
+        else if (g_mouseRClickButton && !g_mouseLClickButton) // right button down?
+        {
+            m = Rbt(glm::vec3(dx, dy, 0.0f) * translation_scale);
+        }
+        else if (z_translating()) // middle or (left and right), or (left + space) button down?
+        {
+            m = Rbt(glm::vec3(0, 0, -dy) * translation_scale);
+        }
+
+        if ((g_currentView == 0) && (g_activeObject == 0))    // if eye is sky, and sky is active
+            m = inv(m);                        // signs are inverted when manipulating the eye frame
+
+        composed = eyeIsActive ? composed * m : m * composed;
+
+        g_mouseClickX = x;
+        g_mouseClickY = y;
     }
+    g_pendingMotion.clear();
 
     // apply it to active object wrt to A
-    if (g_mouseClickDown)
+    const Rbt A = setWrtFrame(g_activeObject, g_currentView, g_skyAMatrixChoice);
+    if ((g_currentView == 0) && (g_activeObject == 0))     // if eye is sky, and sky is active
+        g_skyRbt = doMtoOwrtA(composed, g_skyRbt, A);
+    else if (g_activeObject != 0) {        // if cube is active
+        int k = g_activeObject - 1;    // cube index
+        g_objectRbt[k] = doMtoOwrtA(composed, g_objectRbt[k], A);
+    }
+    g_redisplay = true;
+}
+
+static void printActiveObject() {
+    cout << "Active object is " <<
+        ((g_activeObject == 0) ? "Sky " : "Cube " + to_string(g_activeObject - 1)) << endl;
+}
+
+// The scene object seen at window position (x, y), in OpenGL window
+// coordinates, or -1 if there is none. Casts a ray from the eye through the
+// pixel at the bounds of the objects, then at the triangles of those it hits,
+// ignoring the cube the scene is viewed from.
+static int pickSceneObject(double x, double y)
+{
+    const glm::vec4 ndc((2 * x + 1) / g_windowWidth - 1, (2 * y + 1) / g_windowHeight - 1, 0, 1);
+    const glm::vec4 p = glm::inverse(makeProjectionMatrix()) * ndc;
+    const Rbt eyeRbt = (g_currentView == 0) ? g_skyRbt : g_objectRbt[g_currentView - 1];
+    const Ray ray(eyeRbt.t, eyeRbt.transformVector(glm::normalize(glm::vec3(p) / p.w)));
+
+    // objects moved since the last frame refitted the hierarchy, if there is
+    // a new frame to draw
+    if (g_redisplay)
     {
-        A = setWrtFrame(g_activeObject, g_currentView, g_skyAMatrixChoice);
+        for (size_t i = 0; i < g_sceneObjects.size(); ++i)
+            g_sceneBvh.setBounds(i, getWorldBounds(g_sceneObjects[i]));
+        g_sceneBvh.refit();
+    }
 
-        if ((g_currentView == 0) && (g_activeObject == 0)) {    // if eye is sky, and sky is active
-            m = glm::inverse(m);               // signs are inverted when manipulating the eye frame
-            g_skyRbt = doMtoOwrtA(m, g_skyRbt, A);
-        }
-        else if (g_activeObject != 0) {        // if cube is active
-            int k = g_activeObject - 1;    // cube index
-            g_objectRbt[k] = doMtoOwrtA(m, g_objectRbt[k], A);
+    float t = FLT_MAX;
+    return g_sceneBvh.raycast(ray, [&ray](int id, float& tHit) {
+        const SceneObject& object = g_sceneObjects[id];
+        // the ray starts inside the cube seen from, which hides nothing as
+        // its faces are culled from the inside
+        if (g_currentView != 0 && object.activeObjectId == g_currentView)
+            return false;
+        const shared_ptr<const PickMesh>& mesh = object.geometry->getPickMesh();
+        if (!mesh) {
+            // pick by the bounds, if known
+            float tEnter;
+            if (object.geometry->getBounds().isEmpty() ||
+                !g_sceneBvh.getBounds(id).intersects(ray, 1.0f / ray.direction, tHit, tEnter))
+                return false;
+            tHit = tEnter;
+            return true;
         }
-    }
+        // rigid transforms keep distances, so t is the same in object space
+        const Rbt invRbt = inv(*object.rbt);
+        return mesh->intersect(Ray(invRbt.transformPoint(ray.origin), invRbt.transformVector(ray.direction)), tHit);
+    }, t);
+}
 
-    g_mouseClickX = x;
-    g_mouseClickY = g_windowHeight - y - 1;
+// make the object clicked on the one being manipulated, or the sky if there is
+// none, or if it cannot be manipulated
+static void pickObject(double x, double y) {
+    const int picked = pickSceneObject(x, y);
+    g_activeObject = picked >= 0 ? max(0, g_sceneObjects[picked].activeObjectId) : 0;
+    printActiveObject();
 }
 
 static void mouse(GLFWwindow* window, int button, int action, int mods)
 {
+    applyMotion();    // with the buttons the moves were made with
+
     double x, y;
     glfwGetCursorPos(window, &x, &y);
     g_mouseClickX = x;
@@ -414,6 +622,12 @@ static void mouse(GLFWwindow* window, int button, int action, int mods)
     g_mouseMClickButton &= !(button == GLFW_MOUSE_BUTTON_MIDDLE && action == GLFW_RELEASE);
 
     g_mouseClickDown = g_mouseLClickButton || g_mouseRClickButton || g_mouseMClickButton;
+
+    // shift + left click picks the object to manipulate, which the drag then moves
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS && (mods & GLFW_MOD_SHIFT))
+        pickObject(g_mouseClickX, g_mouseClickY);
+
+    g_redisplay = true;    // the arcball size depends on the buttons, and its place on the active object
 }
 
 
@@ -426,8 +640,7 @@ static void cycleEyeMode() {
 // cycle over object being manipulated.
 static void cycleObject() {
     g_activeObject = (g_activeObject + 1) % g_nViews;
-    cout << "Active object is " <<
-        ((g_activeObject == 0) ? "Sky " : "Cube " + to_string(g_activeObject - 1)) << endl;
+    printActiveObject();
 }
 
 // toggle sky A matrix
@@ -440,6 +653,11 @@ static void toggleSkyAMatrix() {
 
 void keyboard(GLFWwindow* window, int key, int scancode, int action, int mode)
 {
+    // most keys change the view, the scene or the script, and the modes the
+    // pending moves were made in
+    applyMotion();
+    g_redisplay = true;
+
     if (action == GLFW_PRESS)
     {
         switch (key)
@@ -454,11 +672,19 @@ void keyboard(GLFWwindow* window, int key, int scancode, int action, int mode)
                 << "s\t\tsave screenshot\n"
                 << "f\t\tToggle flat shading on/off.\n"
                 << "o\t\tCycle object to edit\n"
+                << "shift+click\tPick object to edit\n"
                 << "v\t\tCycle view\n"
-                << "m\t\tToggle wrt frame (when manipulating sky eye)"
+                << "m\t\tToggle wrt frame (when manipulating sky eye)\n"
+                << "g\t\tPrint GL state changes and objects in view of the last frame, and texture memory\n"
                 << "drag left mouse to rotate\n"
                 << endl;
             break;
+        case GLFW_KEY_G:
+            cout << "GL state changes in last frame: " << g_frameGlCallsIssued << " issued, "
+                 << g_frameGlCallsSkipped << " skipped as redundant" << endl;
+            cout << "Objects in view: " << g_visibleObjects.size() << " of " << g_sceneObjects.size() << endl;
+            ImageTextureLibrary::getSingleton().reportMemory(cout);
+            break;
         case GLFW_KEY_S:
             glFlush();
             writePpmScreenshot(g_windowWidth, g_windowHeight, "out.ppm");
@@ -502,6 +728,7 @@ void keyboard(GLFWwindow* window, int key, int scancode, int action, int mode)
             else
             {
                 g_script->init_playback();
+                g_anim_time = 0.0f;
                 g_animation_on = !g_animation_on;
             }
             break;
@@ -552,11 +779,19 @@ GLFWwindow* initGLFWState()
     // Make the window's context current
     glfwMakeContextCurrent(window);
 
+    // Sync swaps to the display refresh, letting late frames through right
+    // away where the driver supports it (adaptive vsync)
+    if (glfwExtensionSupported("WGL_EXT_swap_control_tear") || glfwExtensionSupported("GLX_EXT_swap_control_tear"))
+        glfwSwapInterval(-1);
+    else
+        glfwSwapInterval(1);
+
     // register callbacks
     glfwSetKeyCallback(window, keyboard);            // key press callback
     glfwSetWindowSizeCallback(window, reshape);      // window reshape callback
     glfwSetCursorPosCallback(window, motion);        // mouse movement callback
     glfwSetMouseButtonCallback(window, mouse);       // mouse click callback
+    glfwSetWindowRefreshCallback(window, refresh);   // window damage callback
 
     return window;
 }
@@ -568,21 +803,47 @@ static void initGLState()
     glClearDepth(0.);
     glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
     glPixelStorei(GL_PACK_ALIGNMENT, 1);
-    glCullFace(GL_BACK);
-    glEnable(GL_CULL_FACE);
-    glEnable(GL_DEPTH_TEST);
-    glDepthFunc(GL_GREATER);
+    GlStateCache& gl = GlStateCache::getSingleton();
+    gl.cullFace(GL_BACK);
+    gl.setEnabled(GL_CULL_FACE, true);
+    gl.setEnabled(GL_DEPTH_TEST, true);
+    gl.depthFunc(GL_GREATER);
     glReadBuffer(GL_BACK);
-    glEnable(GL_FRAMEBUFFER_SRGB);
-    glEnable(GL_MULTISAMPLE);
+    gl.setEnabled(GL_FRAMEBUFFER_SRGB, true);
+    gl.setEnabled(GL_MULTISAMPLE, true);
 }
 
 
 
-static void initGeometry()
+// Replaces the cubes by a model, read from an OBJ file or a binary mesh file
+static void initModel(const string& fileName) {
+    if (fileName.size() > 4 && fileName.compare(fileName.size() - 4, 4, ".obj") == 0)
+        g_cube = importObjGeometry(fileName.c_str());
+    else
+        g_cube.reset(new MeshFileGeometry(fileName.c_str()));
+}
+
+static void initScene() {
+    SceneObject ground = { g_ground, g_bumpFloorMat, &g_groundRbt, 0, -1 };
+    g_sceneObjects.push_back(ground);
+    for (int i = 0; i < g_nObjects; ++i) {
+        SceneObject cube = { g_cube, g_cubeDiffuseMat[i], &g_objectRbt[i], 0, i + 1 };
+        g_sceneObjects.push_back(cube);
+    }
+
+    vector<Aabb> bounds;
+    for (size_t i = 0; i < g_sceneObjects.size(); ++i)
+        bounds.push_back(getWorldBounds(g_sceneObjects[i]));
+    g_sceneBvh.build(bounds);
+    g_sceneTransforms.resize(g_sceneObjects.size());
+}
+
+static void initGeometry(const char *modelFileName)
 {
     initGround();
     initCubes();
+    if (modelFileName)
+        initModel(modelFileName);
     initSphere();
     initAnimation();
 }
@@ -592,20 +853,24 @@ static void initMaterials() {
     Material diffuse("./shaders/basic.vert", "./shaders/diffuse.frag");
     Material solid("./shaders/basic.vert", "./shaders/solid.frag");
 
+    // textures are shared between materials through the texture library, and
+    // loaded in the background: they show a placeholder until they are ready
+    ImageTextureLibrary& textures = ImageTextureLibrary::getSingleton();
+
     // copy diffuse prototype and set red color
     g_cubeDiffuseMat[0].reset(new Material(diffuse));
     g_cubeDiffuseMat[0]->getUniforms().put("uColor", glm::vec3(1.0f, 0.0f, 0.0f));
-    g_cubeDiffuseMat[0]->getUniforms().put("uTexColor", shared_ptr<ImageTexture>(new ImageTexture("smiley.ppm", true)));
+    g_cubeDiffuseMat[0]->getUniforms().put("uTexColor", textures.getTextureAsync("smiley.ppm", true));
 
     // copy diffuse prototype and set blue color
     g_cubeDiffuseMat[1].reset(new Material(diffuse));
     g_cubeDiffuseMat[1]->getUniforms().put("uColor", glm::vec3(0.0f, 0.0f, 1.0f));
-    g_cubeDiffuseMat[1]->getUniforms().put("uTexColor", shared_ptr<ImageTexture>(new ImageTexture("smiley.ppm", true)));
+    g_cubeDiffuseMat[1]->getUniforms().put("uTexColor", textures.getTextureAsync("smiley.ppm", true));
 
     // normal mapping material
     g_bumpFloorMat.reset(new Material("./shaders/normal.vert", "./shaders/normal.frag"));
-    g_bumpFloorMat->getUniforms().put("uTexColor", shared_ptr<ImageTexture>(new ImageTexture("Fieldstone.ppm", true)));
-    g_bumpFloorMat->getUniforms().put("uTexNormal", shared_ptr<ImageTexture>(new ImageTexture("FieldstoneNormal.ppm", false)));
+    g_bumpFloorMat->getUniforms().put("uTexColor", textures.getTextureAsync("Fieldstone.ppm", true));
+    g_bumpFloorMat->getUniforms().put("uTexNormal", textures.getTextureAsync("FieldstoneNormal.ppm", false));
 
     // copy solid prototype, and set to wireframed/transparent rendering
     g_arcballMat.reset(new Material(solid));
@@ -614,13 +879,16 @@ static void initMaterials() {
     //g_arcballMat->getRenderStates().polygonMode(GL_FRONT_AND_BACK, GL_LINE);
     g_arcballMat->getRenderStates().enable(GL_BLEND);
     g_arcballMat->getRenderStates().blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    // per-frame uniforms, filled and bound at the start of drawStuff
+    g_frameBlock.reset(new UniformBlock("FrameBlock", true));
 };
 
 bool testSlerping()
 {
     //Testing Slerping
-    glm::quat cube1rot = glm::quat(g_objectRbt[0]);
-    glm::quat cube2rot = glm::quat(g_objectRbt[1]);
+    glm::quat cube1rot = g_objectRbt[0].r;
+    glm::quat cube2rot = g_objectRbt[1].r;
     glm::quat interpolatedRot = glm::slerp(cube1rot, cube2rot, 0.0f);
 
     return (cube1rot == interpolatedRot);
@@ -644,30 +912,68 @@ int main(int argc, char** argv)
 
     initGLState();
     initMaterials();
-    initGeometry();
+    initGeometry(argc > 1 ? argv[1] : NULL);
+    initScene();
 
+    // Wake the loop below when a texture finished decoding in the background
+    TextureLoader::getSingleton().setDecodedCallback(glfwPostEmptyEvent);
+
+    double lastFrameTime = glfwGetTime();
+    bool wasAnimating = false, wasLinking = false;
     while (!glfwWindowShouldClose(window)) // Loop until the user closes the window
     {
+        const double frameTime = glfwGetTime();
         if (g_animation_on)
         {
+            // advance by the time the last frame took, as paced by vsync, so
+            // that playback speed does not depend on the refresh rate. Stalls
+            // (e.g., dragging the window) do not skip ahead.
+            if (wasAnimating)
+                g_anim_time += 1000.0f * (float) std::min(frameTime - lastFrameTime, 0.1);
+
             float t = g_anim_time / (float)g_ms_between_keyframes;
             bool end_reached = g_script->interpolate(t);
 
-            if (!end_reached)
-            {
-                g_anim_time += 1000.0f / (float)g_animate_fps;
-            }
-
-            else
+            if (end_reached)
             {
                 g_animation_on = false;
                 std::cout << "Finished playing animation. " << std::endl;
                 g_script->end_playback();
             }
+            g_redisplay = true;
         }
-        display(window);  // Render
-        glfwWaitEventsTimeout(1.0f / (float) g_animate_fps);
-        glfwPollEvents(); // Poll for and process events
+        wasAnimating = g_animation_on;
+        lastFrameTime = frameTime;
+
+        // Apply the mouse moves since the last frame
+        applyMotion();
+
+        // Make finished textures visible; more may be waiting past the budget
+        const bool uploaded = TextureLoader::getSingleton().processUploads() > 0;
+        if (uploaded)
+            g_redisplay = true;
+
+        // Objects are not drawn while the driver is still linking their
+        // programs, so keep redrawing until it is done, and once more after
+        const bool linking = Material::pollPrograms() > 0;
+        if (linking || wasLinking)
+            g_redisplay = true;
+        wasLinking = linking;
+
+        if (g_redisplay)
+        {
+            g_redisplay = false;
+            display(window);  // Render
+        }
+
+        // Keep rendering during playback and links, at most at g_animate_fps in
+        // case the swaps are not synced, and otherwise sleep until something happens
+        if (g_animation_on || linking)
+            glfwWaitEventsTimeout(std::max(0.0, 1.0 / g_animate_fps - (glfwGetTime() - frameTime)));
+        else if (uploaded)
+            glfwPollEvents();
+        else
+            glfwWaitEvents();
     }
 
     glfwTerminate();
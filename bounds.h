@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cfloat>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+// Half line origin + t * direction, t >= 0. The direction is unit length, so
+// that t is a distance, and rigid transforms keep it so.
+struct Ray {
+  glm::vec3 origin, direction;
+
+  Ray(const glm::vec3& _origin, const glm::vec3& _direction) : origin(_origin), direction(_direction) {}
+
+  glm::vec3 at(float t) const {
+    return origin + t * direction;
+  }
+};
+
+// Axis aligned bounding box. Default constructed boxes are empty, and grow
+// with extend().
+struct Aabb {
+  glm::vec3 min, max;
+
+  Aabb() : min(FLT_MAX), max(-FLT_MAX) {}
+
+  Aabb(const glm::vec3& _min, const glm::vec3& _max) : min(_min), max(_max) {}
+
+  bool isEmpty() const {
+    return min.x > max.x;
+  }
+
+  Aabb& extend(const glm::vec3& p) {
+    min = glm::min(min, p);
+    max = glm::max(max, p);
+    return *this;
+  }
+
+  Aabb& extend(const Aabb& b) {
+    min = glm::min(min, b.min);
+    max = glm::max(max, b.max);
+    return *this;
+  }
+
+  glm::vec3 getCenter() const {
+    return (min + max) * 0.5f;
+  }
+
+  // Half the size along each axis
+  glm::vec3 getExtent() const {
+    return (max - min) * 0.5f;
+  }
+
+  float getSurfaceArea() const {
+    if (isEmpty())
+      return 0;
+    const glm::vec3 d = max - min;
+    return 2 * (d.x * d.y + d.y * d.z + d.z * d.x);
+  }
+
+  // Slab test: true if the ray enters the box at a distance in [0, tMax],
+  // setting tEnter to it (0 if the origin is inside). `invDirection' is
+  // 1 / ray.direction, computed once for the many boxes tested with a ray.
+  bool intersects(const Ray& ray, const glm::vec3& invDirection, float tMax, float& tEnter) const {
+    if (isEmpty())
+      return false;
+    const glm::vec3 t0 = (min - ray.origin) * invDirection;
+    const glm::vec3 t1 = (max - ray.origin) * invDirection;
+    const glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+    tEnter = std::fmax(std::fmax(tNear.x, tNear.y), std::fmax(tNear.z, 0.0f));
+    const float tExit = std::fmin(std::fmin(tFar.x, tFar.y), std::fmin(tFar.z, tMax));
+    return tEnter <= tExit;
+  }
+
+  // The box enclosing this box transformed by the affine matrix m
+  Aabb transformed(const glm::mat4& m) const {
+    if (isEmpty())
+      return *this;
+    const glm::vec3 c = glm::vec3(m * glm::vec4(getCenter(), 1));
+    const glm::vec3 e = getExtent();
+    const glm::vec3 r(std::fabs(m[0][0]) * e.x + std::fabs(m[1][0]) * e.y + std::fabs(m[2][0]) * e.z,
+                      std::fabs(m[0][1]) * e.x + std::fabs(m[1][1]) * e.y + std::fabs(m[2][1]) * e.z,
+                      std::fabs(m[0][2]) * e.x + std::fabs(m[1][2]) * e.y + std::fabs(m[2][2]) * e.z);
+    return Aabb(c - r, c + r);
+  }
+};
+
+// The six planes of a view frustum, extracted from a projection matrix times
+// a view matrix, in the space that matrix maps from. Plane normals point inside.
+class Frustum {
+public:
+  enum Result {
+    OUTSIDE, INTERSECTS, INSIDE
+  };
+
+  // All planes; pass the mask returned for a box when testing boxes inside it
+  static const unsigned int ALL_PLANES = 0x3f;
+
+  explicit Frustum(const glm::mat4& clipMatrix) {
+    // -w <= x, y, z <= w in clip space, one plane per inequality
+    const glm::mat4 m = glm::transpose(clipMatrix);
+    planes_[0] = m[3] + m[0];
+    planes_[1] = m[3] - m[0];
+    planes_[2] = m[3] + m[1];
+    planes_[3] = m[3] - m[1];
+    planes_[4] = m[3] + m[2];
+    planes_[5] = m[3] - m[2];
+  }
+
+  // Tests a box against the planes in `planeMask', and clears the bits of
+  // the planes the box is completely inside of
+  Result test(const Aabb& b, unsigned int& planeMask) const {
+    if (b.isEmpty())
+      return OUTSIDE;
+    const glm::vec3 c = b.getCenter(), e = b.getExtent();
+    for (int i = 0; i < 6; ++i) {
+      const unsigned int bit = 1u << i;
+      if (!(planeMask & bit))
+        continue;
+      const glm::vec4& p = planes_[i];
+      const float d = p.x * c.x + p.y * c.y + p.z * c.z + p.w;
+      const float r = std::fabs(p.x) * e.x + std::fabs(p.y) * e.y + std::fabs(p.z) * e.z;
+      if (d + r < 0)
+        return OUTSIDE;
+      if (d - r >= 0)
+        planeMask &= ~bit;
+    }
+    return planeMask ? INTERSECTS : INSIDE;
+  }
+
+  bool intersects(const Aabb& b) const {
+    unsigned int mask = ALL_PLANES;
+    return test(b, mask) != OUTSIDE;
+  }
+
+private:
+  glm::vec4 planes_[6];
+};
@@ -0,0 +1,190 @@
+#include <algorithm>
+
+#include "bvh.h"
+
+using namespace std;
+
+void Bvh::build(const vector<Aabb>& bounds) {
+  objectBounds_ = bounds;
+  rebuild();
+}
+
+void Bvh::rebuild() {
+  nodes_.clear();
+  order_.resize(objectBounds_.size());
+  for (size_t i = 0; i < order_.size(); ++i)
+    order_[i] = i;
+
+  Node root;
+  root.first = 0;
+  root.count = order_.size();
+  nodes_.push_back(root);
+  split(0);
+  refitNodes();
+  buildRootArea_ = nodes_[0].bounds.getSurfaceArea();
+}
+
+// Splits a leaf at the median of the object centers along the longest axis
+// of their bounds, recursively
+void Bvh::split(int node) {
+  const int first = nodes_[node].first, count = nodes_[node].count;
+  if (count <= MAX_LEAF_SIZE)
+    return;
+
+  Aabb centers;
+  for (int i = first; i < first + count; ++i)
+    centers.extend(objectBounds_[order_[i]].getCenter());
+  const glm::vec3 size = centers.max - centers.min;
+  const int axis = size.x >= size.y && size.x >= size.z ? 0 : size.y >= size.z ? 1 : 2;
+
+  const int half = count / 2;
+  nth_element(order_.begin() + first, order_.begin() + first + half, order_.begin() + first + count,
+              [this, axis](int a, int b) {
+                return objectBounds_[a].getCenter()[axis] < objectBounds_[b].getCenter()[axis];
+              });
+
+  const int children = nodes_.size();
+  Node left, right;
+  left.first = first;
+  left.count = half;
+  right.first = first + half;
+  right.count = count - half;
+  nodes_.push_back(left);
+  nodes_.push_back(right);
+  nodes_[node].first = children;
+  nodes_[node].count = 0;
+
+  split(children);
+  split(children + 1);
+}
+
+void Bvh::refit() {
+  if (nodes_.empty())
+    return;
+  refitNodes();
+
+  // Objects that moved apart leave large, overlapping nodes behind
+  if (buildRootArea_ > 0 && nodes_[0].bounds.getSurfaceArea() > 2 * buildRootArea_)
+    rebuild();
+}
+
+void Bvh::refitNodes() {
+  // Children come after their parents, so a backwards sweep sees them first
+  for (int n = nodes_.size() - 1; n >= 0; --n) {
+    Node& node = nodes_[n];
+    node.bounds = Aabb();
+    if (node.count > 0) {
+      for (int i = node.first; i < node.first + node.count; ++i)
+        node.bounds.extend(objectBounds_[order_[i]]);
+    }
+    else {
+      node.bounds.extend(nodes_[node.first].bounds).extend(nodes_[node.first + 1].bounds);
+    }
+  }
+}
+
+void Bvh::cull(const Frustum& frustum, vector<int>& visible) const {
+  if (nodes_.empty())
+    return;
+
+  // Nodes to visit, with the planes their parent is not completely inside of
+  int stack[64];
+  unsigned int masks[64];
+  int top = 0;
+  stack[top] = 0;
+  masks[top++] = Frustum::ALL_PLANES;
+
+  while (top > 0) {
+    --top;
+    const Node& node = nodes_[stack[top]];
+    unsigned int mask = masks[top];
+    const Frustum::Result r = frustum.test(node.bounds, mask);
+    if (r == Frustum::OUTSIDE)
+      continue;
+    if (r == Frustum::INSIDE) {
+      appendAll(stack[top], visible);
+      continue;
+    }
+
+    if (node.count > 0) {
+      for (int i = node.first; i < node.first + node.count; ++i) {
+        unsigned int objectMask = mask;
+        if (frustum.test(objectBounds_[order_[i]], objectMask) != Frustum::OUTSIDE)
+          visible.push_back(order_[i]);
+      }
+    }
+    else {
+      stack[top] = node.first;
+      masks[top++] = mask;
+      stack[top] = node.first + 1;
+      masks[top++] = mask;
+    }
+  }
+}
+
+int Bvh::raycast(const Ray& ray, const function<bool(int, float&)>& hitObject, float& t) const {
+  if (nodes_.empty())
+    return -1;
+
+  const glm::vec3 invDirection = 1.0f / ray.direction;
+  int closest = -1;
+
+  // Nodes to visit, with the distance at which the ray enters them
+  int stack[64];
+  float enter[64];
+  int top = 0;
+  if (!nodes_[0].bounds.intersects(ray, invDirection, t, enter[top]))
+    return -1;
+  stack[top++] = 0;
+
+  while (top > 0) {
+    --top;
+    if (enter[top] > t)
+      continue;
+    const Node& node = nodes_[stack[top]];
+
+    if (node.count > 0) {
+      for (int i = node.first; i < node.first + node.count; ++i) {
+        const int id = order_[i];
+        float tBox;
+        if (objectBounds_[id].intersects(ray, invDirection, t, tBox) && hitObject(id, t))
+          closest = id;
+      }
+      continue;
+    }
+
+    // Push the farther child first, so that the nearer one is visited first
+    float tLeft, tRight;
+    const bool left = nodes_[node.first].bounds.intersects(ray, invDirection, t, tLeft);
+    const bool right = nodes_[node.first + 1].bounds.intersects(ray, invDirection, t, tRight);
+    if (left && right && tLeft < tRight) {
+      stack[top] = node.first + 1;
+      enter[top++] = tRight;
+      stack[top] = node.first;
+      enter[top++] = tLeft;
+    }
+    else {
+      if (left) {
+        stack[top] = node.first;
+        enter[top++] = tLeft;
+      }
+      if (right) {
+        stack[top] = node.first + 1;
+        enter[top++] = tRight;
+      }
+    }
+  }
+  return closest;
+}
+
+void Bvh::appendAll(int node, vector<int>& visible) const {
+  const Node& n = nodes_[node];
+  if (n.count > 0) {
+    for (int i = n.first; i < n.first + n.count; ++i)
+      visible.push_back(order_[i]);
+  }
+  else {
+    appendAll(n.first, visible);
+    appendAll(n.first + 1, visible);
+  }
+}
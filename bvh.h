@@ -0,0 +1,78 @@
+#pragma once
+
+#include <functional>
+#include <vector>
+
+#include "bounds.h"
+
+// Bounding volume hierarchy over the world space bounds of scene objects,
+// used to cull them against the view frustum.
+//
+// The tree is built once over the objects, and refitted to their new bounds
+// every frame, which keeps its structure. When motion has degraded the tree
+// too much, refit() rebuilds it.
+//
+//   bvh.build(bounds);           // once, objects are identified by index
+//   ...
+//   bvh.setBounds(i, newBounds); // for the objects that moved
+//   bvh.refit();
+//   bvh.cull(Frustum(proj * invEyeRbt), visible);
+//
+// It also finds the objects hit by rays, e.g., to pick them with the mouse.
+class Bvh {
+public:
+  Bvh() : buildRootArea_(0) {}
+
+  // Replaces all objects, object i having bounds[i]
+  void build(const std::vector<Aabb>& bounds);
+
+  // Takes effect at the next refit()
+  void setBounds(int id, const Aabb& bounds) {
+    objectBounds_[id] = bounds;
+  }
+
+  const Aabb& getBounds(int id) const {
+    return objectBounds_[id];
+  }
+
+  int getNumObjects() const {
+    return objectBounds_.size();
+  }
+
+  // Recomputes the bounds of the nodes from the bounds of the objects
+  void refit();
+
+  // Appends the indices of the objects whose bounds intersect the frustum
+  void cull(const Frustum& frustum, std::vector<int>& visible) const;
+
+  // Finds the object closest along the ray. The ray is tested against the
+  // bounds first, then hitObject(id, t) tests object id exactly: it returns
+  // true if the object is hit before distance t, lowering t to the hit. Nodes
+  // are visited near to far, and skipped once behind the closest hit.
+  // Returns the closest object, with its distance in t, or -1 if none is hit
+  // before the initial t.
+  int raycast(const Ray& ray, const std::function<bool(int, float&)>& hitObject, float& t) const;
+
+private:
+  // Children of an inner node are at nodes_[first] and nodes_[first + 1]. A
+  // leaf holds the objects order_[first .. first + count). Children are always
+  // stored after their parent.
+  struct Node {
+    Aabb bounds;
+    int first, count;
+  };
+
+  static const int MAX_LEAF_SIZE = 4;
+
+  std::vector<Node> nodes_;
+  std::vector<int> order_;
+  std::vector<Aabb> objectBounds_;
+  float buildRootArea_;
+
+  void rebuild();
+
+  // Recomputes the node bounds bottom up, keeping the tree as it is
+  void refitNodes();
+  void split(int node);
+  void appendAll(int node, std::vector<int>& visible) const;
+};
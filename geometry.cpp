@@ -1,6 +1,8 @@
 #include <stdexcept>
 #include <string>
 #include <cstddef>
+#include <algorithm>
+#include <cstring>
 
 #include "geometry.h"
 
@@ -23,6 +25,111 @@ const VertexFormat VertexPNTBX::FORMAT = VertexFormat(sizeof(VertexPNTBX))
                                          .put("aTexCoord", 2, GL_FLOAT, GL_FALSE, offsetof(VertexPNX, x));
 
 
+const VertexFormat VertexPackedPNTX::FORMAT = VertexFormat(sizeof(VertexPackedPNTX))
+                                              .put("aPosition", 3, GL_FLOAT, GL_FALSE, offsetof(VertexPackedPNTX, p))
+                                              .put("aNormal", 4, GL_INT_2_10_10_10_REV, GL_TRUE, offsetof(VertexPackedPNTX, n))
+                                              .put("aTangent", 4, GL_INT_2_10_10_10_REV, GL_TRUE, offsetof(VertexPackedPNTX, t))
+                                              .put("aTexCoord", 2, GL_HALF_FLOAT, GL_FALSE, offsetof(VertexPackedPNTX, x));
+
+BufferRing::BufferRing() : slotSize_(0), slot_(0) {
+  for (int i = 0; i < NUM_SLOTS; ++i)
+    fences_[i] = 0;
+}
+
+BufferRing::~BufferRing() {
+  reset();
+}
+
+void BufferRing::reset() {
+  for (int i = 0; i < NUM_SLOTS; ++i) {
+    if (fences_[i])
+      glDeleteSync(fences_[i]);
+    fences_[i] = 0;
+  }
+  slotSize_ = 0;
+  slot_ = 0;
+}
+
+int BufferRing::write(GLenum target, const void *data, size_t size, size_t slotSize) {
+  assert(size <= slotSize);
+
+  if (slotSize != slotSize_) {
+    // (re)allocate; the previous storage is orphaned, so nothing to wait for
+    reset();
+    slotSize_ = slotSize;
+    glBufferData(target, NUM_SLOTS * slotSize, NULL, GL_STREAM_DRAW);
+  }
+  else {
+    // everything issued so far may read the current slot
+    if (fences_[slot_])
+      glDeleteSync(fences_[slot_]);
+    fences_[slot_] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    slot_ = (slot_ + 1) % NUM_SLOTS;
+    if (fences_[slot_]) {
+      GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+      while (glClientWaitSync(fences_[slot_], flags, 1000000000) == GL_TIMEOUT_EXPIRED)
+        flags = 0;
+      glDeleteSync(fences_[slot_]);
+      fences_[slot_] = 0;
+    }
+  }
+
+  if (size > 0) {
+    void *dst = glMapBufferRange(target, slot_ * slotSize_, size,
+                                 GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    if (dst == NULL)
+      throw runtime_error("BufferRing: cannot map buffer");
+    memcpy(dst, data, size);
+    glUnmapBuffer(target);
+  }
+  return slot_;
+}
+
+const float Geometry::LOD_HYSTERESIS = 0.1f;
+
+void Geometry::addLod(const shared_ptr<Geometry>& lod, float screenSize) {
+  assert(lods_.empty() || screenSize < lods_.back().second);
+  lods_.push_back(make_pair(lod, screenSize));
+}
+
+int Geometry::selectLod(float screenSize, int currentLevel) const {
+  int level = min(max(currentLevel, 0), (int)lods_.size());
+  // lods_[level] is the next coarser level, lods_[level - 1] the current one
+  while (level < (int)lods_.size() && screenSize < lods_[level].second * (1 - LOD_HYSTERESIS))
+    ++level;
+  while (level > 0 && screenSize > lods_[level - 1].second * (1 + LOD_HYSTERESIS))
+    --level;
+  return level;
+}
+
+GLuint Geometry::createVertexArray(GLuint program, const int attribIndices[]) {
+  shared_ptr<GlArrayObject> vao(new GlArrayObject());
+  GlStateCache::getSingleton().bindVertexArray(*vao);
+  setupVertexArray(attribIndices);
+
+  vertexArrays_.push_back(make_pair(program, vao));
+  return *vao;
+}
+
+void FormattedIbo::uploadNarrowed(const unsigned int *indices, int length, bool dynamicUsage) {
+  switch (format_) {
+  case GL_UNSIGNED_INT:
+    upload(indices, length, dynamicUsage);
+    break;
+  case GL_UNSIGNED_SHORT: {
+    vector<GLushort> narrowed(indices, indices + length);
+    upload(narrowed.data(), length, dynamicUsage);
+    break;
+  }
+  default: {
+    vector<GLubyte> narrowed(indices, indices + length);
+    upload(narrowed.data(), length, dynamicUsage);
+    break;
+  }
+  }
+}
+
 BufferObjectGeometry::BufferObjectGeometry()
   : wiringChanged_(true),
   primitiveType_(GL_TRIANGLES)
@@ -34,6 +141,7 @@ BufferObjectGeometry& BufferObjectGeometry::wire(
   const string& sourceAttribName) {
   wiringChanged_ = true;
   wiring_[targetAttribName] = make_pair(source, sourceAttribName);
+  invalidateVertexArrays();
   return *this;
 }
 
@@ -51,6 +159,7 @@ BufferObjectGeometry& BufferObjectGeometry::wire(shared_ptr<FormattedVbo> source
 
 BufferObjectGeometry& BufferObjectGeometry::indexedBy(shared_ptr<FormattedIbo> ib) {
   ib_ = ib;
+  invalidateVertexArrays();
   return *this;
 }
 
@@ -80,36 +189,53 @@ const vector<string>& BufferObjectGeometry::getVertexAttribNames() {
   return vertexAttribNames_;
 }
 
-void BufferObjectGeometry::draw(int attribIndices[]) {
+void BufferObjectGeometry::setupVertexArray(const int attribIndices[]) {
   if (wiringChanged_)
     processWiring();
 
-  const unsigned int UNDEFINED_VB_LEN = 0xFFFFFFFF;
-  unsigned int vboLen = UNDEFINED_VB_LEN;
-
   // bind the vertex buffer and set vertex attribute pointers
   for (int i = 0, n = perVbWirings_.size(); i < n; ++i) {
     const PerVbWiring &pvw = perVbWirings_[i];
     const VertexFormat& vfd = pvw.vb->getVertexFormat();
 
-    glBindBuffer(GL_ARRAY_BUFFER, *(pvw.vb));
-
-    vboLen = fmin(vboLen, (unsigned int)pvw.vb->length());
+    GlStateCache::getSingleton().bindBuffer(GL_ARRAY_BUFFER, *(pvw.vb));
 
     for (size_t j = 0; j < pvw.vb2GeoIdx.size(); ++j) {
       int loc = attribIndices[pvw.vb2GeoIdx[j].second];
-      if (loc >= 0)
+      if (loc >= 0) {
         vfd.setGlVertexAttribPointer(pvw.vb2GeoIdx[j].first, loc);
+        glEnableVertexAttribArray(loc);
+      }
     }
   }
 
+  if (isIndexed())
+    GlStateCache::getSingleton().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, *ib_);
+}
+
+void BufferObjectGeometry::drawPrimitives() {
+  // Vertices uploaded as dynamic data live at an offset within their buffer.
+  // All vbos of a geometry are expected to be uploaded together with the same
+  // slot size, and hence to share that offset.
+  const int baseVertex = perVbWirings_.empty() ? 0 : perVbWirings_[0].vb->getBaseVertex();
+#ifndef NDEBUG
+  for (int i = 1, n = perVbWirings_.size(); i < n; ++i)
+    assert(perVbWirings_[i].vb->getBaseVertex() == baseVertex);
+#endif
+
   if (isIndexed()) {
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *ib_);
-    glDrawElements(primitiveType_, ib_->length(), ib_->getIndexFormat(), 0);
-  }
-  else if (vboLen != UNDEFINED_VB_LEN) {
-    glDrawArrays(primitiveType_, 0, vboLen);
+    glDrawElementsBaseVertex(primitiveType_, ib_->length(), ib_->getIndexFormat(),
+                             reinterpret_cast<const GLvoid*>(ib_->getOffset()), baseVertex);
+    return;
   }
+
+  const unsigned int UNDEFINED_VB_LEN = 0xFFFFFFFF;
+  unsigned int vboLen = UNDEFINED_VB_LEN;
+  for (int i = 0, n = perVbWirings_.size(); i < n; ++i)
+    vboLen = min(vboLen, (unsigned int)perVbWirings_[i].vb->length());
+
+  if (vboLen != UNDEFINED_VB_LEN)
+    glDrawArrays(primitiveType_, baseVertex, vboLen);
 }
 
 void BufferObjectGeometry::processWiring() {
@@ -7,25 +7,112 @@
 #include <string>
 #include <stdexcept>
 #include <memory>
+#include <utility>
+#include <limits>
 
 #include <glm/glm.hpp>    
+#include <glm/gtc/packing.hpp>
 #include "glsupport.h"
 #include "geometrymaker.h"
+#include "bounds.h"
+
+class PickMesh;
 
 // An abstract class that encapsulates geometry data that provides vertex attributes and
 // know how to draw itself.
+//
+// A geometry keeps one vertex array object per GL program it is drawn with,
+// holding the complete attribute wiring for that program. It is built on the
+// first draw with the program, so that later draws only bind it.
 class Geometry {
 public:
   // return names of vertex attributes provided by this geometry
   virtual const std::vector<std::string>& getVertexAttribNames() = 0;
 
-  // Draw the geometry. attribIndices[i] corresponds to the index of the
-  // shader vertex attribute location that the i-th vertex attribute provided
-  // by this geometry should bind to. It can be -1 to indicate that this stream is
-  // not used. The caller is responsible for enable/disable vertex attribute arrays.
-  virtual void draw(int attribIndices[]) = 0;
+  // Records the vertex attribute setup into the currently bound vertex array
+  // object. attribIndices[i] corresponds to the index of the shader vertex
+  // attribute location that the i-th vertex attribute provided by this geometry
+  // should bind to. It can be -1 to indicate that this stream is not used.
+  // Enables the used vertex attribute arrays and binds the index buffer, if any.
+  virtual void setupVertexArray(const int attribIndices[]) = 0;
+
+  // Issues the draw call. The vertex array object set up by setupVertexArray
+  // must be bound.
+  virtual void drawPrimitives() = 0;
+
+  // Returns the vertex array object for the given program, or 0 if there is none yet
+  GLuint getVertexArray(GLuint program) const {
+    for (size_t i = 0; i < vertexArrays_.size(); ++i) {
+      if (vertexArrays_[i].first == program)
+        return *vertexArrays_[i].second;
+    }
+    return 0;
+  }
+
+  // Creates and remembers the vertex array object for the given program, set
+  // up with setupVertexArray(attribIndices)
+  GLuint createVertexArray(GLuint program, const int attribIndices[]);
+
+  // Object space bounds of the vertex positions, empty if unknown. Set by
+  // the geometries below when their vertices are uploaded.
+  const Aabb& getBounds() const {
+    return bounds_;
+  }
+
+  void setBounds(const Aabb& bounds) {
+    bounds_ = bounds;
+  }
+
+  // CPU copy of the triangles, for picking objects exactly. NULL unless set by
+  // the creator of the geometry, which decides whether the memory is worth it.
+  const std::shared_ptr<const PickMesh>& getPickMesh() const {
+    return pickMesh_;
+  }
+
+  void setPickMesh(const std::shared_ptr<const PickMesh>& pickMesh) {
+    pickMesh_ = pickMesh;
+  }
+
+  // Levels of detail: coarser versions of this geometry, each to be drawn
+  // when the geometry covers less than `screenSize' pixels, e.g., in projected
+  // bounding sphere diameter. Levels are added from the finest to the coarsest.
+  void addLod(const std::shared_ptr<Geometry>& lod, float screenSize);
+
+  // Number of levels, including this geometry as level 0
+  int getNumLods() const {
+    return lods_.size() + 1;
+  }
+
+  Geometry& getLod(int level) {
+    return level == 0 ? *this : *lods_[level - 1].first;
+  }
+
+  // The level to draw at `screenSize' pixels for an object drawn at
+  // `currentLevel' so far. The level only changes once the size is more than
+  // LOD_HYSTERESIS away from the threshold, so that objects hovering around
+  // it do not flicker between levels.
+  int selectLod(float screenSize, int currentLevel) const;
+
+  static const float LOD_HYSTERESIS;
 
   virtual ~Geometry() {}
+
+protected:
+  // To be called by implementations whenever the vertex attributes or the
+  // buffers they come from change
+  void invalidateVertexArrays() {
+    vertexArrays_.clear();
+  }
+
+private:
+  Aabb bounds_;
+  std::shared_ptr<const PickMesh> pickMesh_;
+
+  // Coarser levels and the screen sizes below which they are used
+  std::vector<std::pair<std::shared_ptr<Geometry>, float> > lods_;
+
+  // GL program handle --> vertex array object
+  std::vector<std::pair<GLuint, std::shared_ptr<GlArrayObject> > > vertexArrays_;
 };
 
 
@@ -110,17 +197,58 @@ private:
   std::map<std::string, int> name2Idx_;
 };
 
+// Splits a buffer object into NUM_SLOTS slots that are written in turn, for
+// data that is replaced every frame or so. Each write goes to the next slot
+// without synchronizing with the GPU, after waiting on a fence placed when that
+// slot was last replaced, i.e., NUM_SLOTS - 1 writes ago. The GPU can thus keep
+// reading earlier slots while the CPU writes, and the buffer is only
+// reallocated when the slot size changes.
+class BufferRing : Noncopyable {
+public:
+  static const int NUM_SLOTS = 3;
+
+  BufferRing();
+  ~BufferRing();
+
+  // Copies `size' bytes into the next slot of the buffer bound to `target',
+  // resizing the slots to `slotSize' bytes first if needed. Returns the index
+  // of the slot written.
+  int write(GLenum target, const void *data, size_t size, size_t slotSize);
+
+  // Forgets the slots, e.g., after the buffer has been reallocated by someone else
+  void reset();
+
+private:
+  GLsync fences_[NUM_SLOTS];
+  size_t slotSize_;
+  int slot_;
+};
+
 // Light wrapper for a GL buffer object storing vertices, together with format for its vertices.
+//
+// Static data is uploaded once into a buffer of the exact size. Dynamic data
+// goes through a BufferRing, and the vertices of the last upload start at
+// getBaseVertex(), which is to be passed to glDraw*BaseVertex or as the first
+// vertex of glDrawArrays.
 class FormattedVbo : public GlBufferObject {
+  const std::shared_ptr<const VertexFormat> ownedFormat_;   // NULL if owned by the caller
   const VertexFormat& format_;
   int length_;
+  int slotCapacity_;   // in vertices, 0 if the data is static
+  int baseVertex_;
+  BufferRing ring_;
 
 public:
   // The passed in formatDesc_ is stored by reference. Hence the caller
   // should either pass in a static global variable, or ensure its lifespan
   // encompasses the lifespan of the FormmatedVbo
   FormattedVbo(const VertexFormat& formatDesc)
-    : format_(formatDesc), length_(0) {}
+    : format_(formatDesc), length_(0), slotCapacity_(0), baseVertex_(0) {}
+
+  // Shares the ownership of the format, for formats built at run time, e.g.,
+  // read from a file
+  FormattedVbo(const std::shared_ptr<const VertexFormat>& formatDesc)
+    : ownedFormat_(formatDesc), format_(*formatDesc), length_(0), slotCapacity_(0), baseVertex_(0) {}
 
   const VertexFormat& getVertexFormat() const {
     return format_;
@@ -131,23 +259,40 @@ public:
     return length_;
   }
 
+  int getBaseVertex() const {
+    return baseVertex_;
+  }
+
   // Upload vertex data to the vbo. Specify dynamicUsage = true if you intend
-  // to upload different data multiple times
+  // to upload different data multiple times, e.g., every frame
   template<typename Vertex>
   void upload(const Vertex* vertices, int length, bool dynamicUsage = false) {
     assert(sizeof(Vertex) == format_.getVertexSize());
-    glBindBuffer(GL_ARRAY_BUFFER, *this);
+    uploadRaw(vertices, length, dynamicUsage);
+  }
+
+  // Same as upload, for vertices of format getVertexFormat() in untyped memory,
+  // e.g., mapped from a file
+  void uploadRaw(const void* vertices, int length, bool dynamicUsage = false) {
+    const int vertexSize = format_.getVertexSize();
+    GlStateCache::getSingleton().bindBuffer(GL_ARRAY_BUFFER, *this);
     length_ = length;
 
-    const int size = sizeof(Vertex) * length;
+    const size_t size = size_t(vertexSize) * length;
     if (dynamicUsage) {
-      // We always call glBufferData with a NULL ptr here, so that OpenGL knows that
-      // we're done with old data, and that if the old vbo is in use, it can  allocate
-      // us a new one without stalling the pipeline
-      glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
-      glBufferSubData(GL_ARRAY_BUFFER, 0, size, vertices);
+      // Slots grow by powers of two, so that data of slowly varying size does
+      // not reallocate every time
+      if (length > slotCapacity_) {
+        slotCapacity_ = 1;
+        while (slotCapacity_ < length)
+          slotCapacity_ *= 2;
+      }
+      const int slot = ring_.write(GL_ARRAY_BUFFER, vertices, size, size_t(vertexSize) * slotCapacity_);
+      baseVertex_ = slot * slotCapacity_;
     }
     else {
+      ring_.reset();
+      slotCapacity_ = baseVertex_ = 0;
       glBufferData(GL_ARRAY_BUFFER, size, vertices, GL_STATIC_DRAW);
     }
 #ifndef NDEBUG
@@ -158,13 +303,19 @@ public:
 
 // Light wrapper for a GL buffer object storing indices, together with format for its
 // indices, one of GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, or GL_UNSIGNED_INT
+//
+// Like FormattedVbo, dynamic data goes through a BufferRing. The indices of the
+// last upload start at byte getOffset() of the buffer.
 class FormattedIbo : public GlBufferObject {
   GLenum format_;
   int length_;
+  int slotCapacity_;   // in indices, 0 if the data is static
+  size_t offset_;
+  BufferRing ring_;
 public:
   // format must be one of GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT,or GL_UNSIGNED_INT
   // GL_UNSIGNED_SHORT is the default
-  FormattedIbo(GLenum format = GL_UNSIGNED_SHORT) : format_(format), length_(0) {
+  FormattedIbo(GLenum format = GL_UNSIGNED_SHORT) : format_(format), length_(0), slotCapacity_(0), offset_(0) {
     assert(format == GL_UNSIGNED_BYTE || format == GL_UNSIGNED_SHORT || format == GL_UNSIGNED_INT);
   }
 
@@ -176,19 +327,57 @@ public:
     return length_;
   }
 
+  size_t getOffset() const {
+    return offset_;
+  }
+
+  // The narrowest format able to index `numVertices' vertices
+  static GLenum chooseFormat(int numVertices) {
+    if (numVertices <= 0x100)
+      return GL_UNSIGNED_BYTE;
+    if (numVertices <= 0x10000)
+      return GL_UNSIGNED_SHORT;
+    return GL_UNSIGNED_INT;
+  }
+
+  // Uploads 32-bit indices, narrowed to the format of the buffer, which must
+  // be wide enough for all of them
+  void uploadNarrowed(const unsigned int *indices, int length, bool dynamicUsage = false);
+
+  // Size in bytes of one index of the given format
+  static int getIndexSize(GLenum format) {
+    return format == GL_UNSIGNED_BYTE ? 1 : format == GL_UNSIGNED_SHORT ? 2 : 4;
+  }
+
   template<typename Index>
   void upload(const Index *indices, int length, bool dynamicUsage = false) {
-    assert((format_ == GL_UNSIGNED_BYTE && sizeof(Index) == 1) ||
-           (format_ == GL_UNSIGNED_SHORT && sizeof(Index) == 2) ||
-           (format_ == GL_UNSIGNED_INT && sizeof(Index) == 4));
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, *this);
+    assert(sizeof(Index) == getIndexSize(format_));
+    uploadRaw(indices, length, dynamicUsage);
+  }
+
+  // Same as upload, for indices of format getIndexFormat() in untyped memory,
+  // e.g., mapped from a file
+  void uploadRaw(const void *indices, int length, bool dynamicUsage = false) {
+    const int indexSize = getIndexSize(format_);
+    // the element array binding belongs to the bound vertex array object,
+    // which must not be modified here
+    GlStateCache::getSingleton().bindVertexArray(0);
+    GlStateCache::getSingleton().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, *this);
     length_ = length;
-    const int size = sizeof(Index) * length;
+    const size_t size = size_t(indexSize) * length;
     if (dynamicUsage) {
-      glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, NULL, GL_DYNAMIC_DRAW);
-      glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, size, indices);
+      if (length > slotCapacity_) {
+        slotCapacity_ = 1;
+        while (slotCapacity_ < length)
+          slotCapacity_ *= 2;
+      }
+      const size_t slotSize = size_t(indexSize) * slotCapacity_;
+      offset_ = ring_.write(GL_ELEMENT_ARRAY_BUFFER, indices, size, slotSize) * slotSize;
     }
     else {
+      ring_.reset();
+      slotCapacity_ = 0;
+      offset_ = 0;
       glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, indices, GL_STATIC_DRAW);
     }
 #ifndef NDEBUG
@@ -250,7 +439,8 @@ public:
 
   // Methods declared by Geometry
   virtual const std::vector<std::string>& getVertexAttribNames();
-  virtual void draw(int attribIndices[]);
+  virtual void setupVertexArray(const int attribIndices[]);
+  virtual void drawPrimitives();
 
 private:
   typedef std::map<std::string, std::pair<std::shared_ptr<FormattedVbo>, std::string> > Wiring;
@@ -408,44 +598,107 @@ struct VertexPNTBX {
   }
 };
 
-// Simple unindex geometry implementation based on BufferObjectGeometry
+// A compact vertex with the same content as VertexPNTBX, in 24 bytes instead
+// of 56: floating point Position, Normal and Tangent packed as
+// GL_INT_2_10_10_10_REV, and half float teXture Coord. The binormal is not
+// stored; the w component of the tangent holds its sign, and shaders
+// reconstruct it as
+//
+//   binormal = cross(aNormal, aTangent.xyz) * aTangent.w
+//
+// The same shaders work with VertexPNTBX, whose aTangent gets w = 1 from GL.
+struct VertexPackedPNTX {
+  glm::vec3 p;
+  GLuint n, t;   // packed normal, and tangent with binormal sign
+  GLuint x;      // two half float texture coordinates
+
+  static const VertexFormat FORMAT;
+
+  VertexPackedPNTX() {}
+
+  VertexPackedPNTX(const glm::vec3& pos, const glm::vec3& normal,
+                   const glm::vec3& tangent, const glm::vec3& binormal, const glm::vec2& texCoords) {
+    set(pos, normal, tangent, binormal, texCoords);
+  }
+
+  // Define copy constructor and assignment operator from GenericVertex so we can
+  // use make* functions from geometrymaker.h
+  VertexPackedPNTX(const GenericVertex& v) {
+    *this = v;
+  }
+
+  VertexPackedPNTX& operator = (const GenericVertex& v) {
+    set(v.pos, v.normal, v.tangent, v.binormal, v.tex);
+    return *this;
+  }
+
+  VertexPackedPNTX(const VertexPNTBX& v) {
+    set(v.p, v.n, v.t, v.b, v.x);
+  }
+
+private:
+  void set(const glm::vec3& pos, const glm::vec3& normal,
+           const glm::vec3& tangent, const glm::vec3& binormal, const glm::vec2& texCoords) {
+    const float sign = glm::dot(glm::cross(normal, tangent), binormal) < 0 ? -1.0f : 1.0f;
+    p = pos;
+    n = glm::packSnorm3x10_1x2(glm::vec4(normal, 0));
+    t = glm::packSnorm3x10_1x2(glm::vec4(tangent, sign));
+    x = glm::packHalf2x16(texCoords);
+  }
+};
+
+// Bounds of the positions `p' of some vertices
+template<typename Vertex>
+Aabb computeBounds(const Vertex* vertices, int numVertices) {
+  Aabb bounds;
+  for (int i = 0; i < numVertices; ++i)
+    bounds.extend(vertices[i].p);
+  return bounds;
+}
+
+// Simple unindex geometry implementation based on BufferObjectGeometry.
+// Pass dynamic = true for geometry that is uploaded again every frame or so.
 template<typename Vertex>
 class SimpleUnindexedGeometry : public BufferObjectGeometry {
   std::shared_ptr<FormattedVbo> vbo;
+  bool dynamic;
 public:
-  SimpleUnindexedGeometry() : vbo(new FormattedVbo(Vertex::FORMAT)) {
+  SimpleUnindexedGeometry(bool dynamic = false) : vbo(new FormattedVbo(Vertex::FORMAT)), dynamic(dynamic) {
     wire(vbo);
     primitiveType(GL_TRIANGLES);
   }
 
-  SimpleUnindexedGeometry(const Vertex* vertices, int numVertices)
-    : vbo(new FormattedVbo(Vertex::FORMAT)) {
+  SimpleUnindexedGeometry(const Vertex* vertices, int numVertices, bool dynamic = false)
+    : vbo(new FormattedVbo(Vertex::FORMAT)), dynamic(dynamic) {
     wire(vbo);
     primitiveType(GL_TRIANGLES);
     upload(vertices, numVertices);
   }
 
   void upload(const Vertex* vertices, int numVertices) {
-    vbo->upload(vertices, numVertices, true);
+    vbo->upload(vertices, numVertices, dynamic);
+    setBounds(computeBounds(vertices, numVertices));
   }
 };
 
 
 // Simple Index geometry implementation based on BufferObjectGeometry
+// Pass dynamic = true for geometry that is uploaded again every frame or so.
 template<typename Vertex, typename Index>
 class SimpleIndexedGeometry : public BufferObjectGeometry {
   std::shared_ptr<FormattedVbo> vbo;
   std::shared_ptr<FormattedIbo> ibo;
+  bool dynamic;
 public:
-  SimpleIndexedGeometry()
-    : vbo(new FormattedVbo(Vertex::FORMAT)), ibo(new FormattedIbo(size2IboFmt(sizeof(Index)))) {
+  SimpleIndexedGeometry(bool dynamic = false)
+    : vbo(new FormattedVbo(Vertex::FORMAT)), ibo(new FormattedIbo(size2IboFmt(sizeof(Index)))), dynamic(dynamic) {
     wire(vbo);
     indexedBy(ibo);
     primitiveType(GL_TRIANGLES);
   }
 
-  SimpleIndexedGeometry(const Vertex* vertices,  const Index* indices, int numVertices, int numIndices)
-    : vbo(new FormattedVbo(Vertex::FORMAT)), ibo(new FormattedIbo(size2IboFmt(sizeof(Index)))) {
+  SimpleIndexedGeometry(const Vertex* vertices,  const Index* indices, int numVertices, int numIndices, bool dynamic = false)
+    : vbo(new FormattedVbo(Vertex::FORMAT)), ibo(new FormattedIbo(size2IboFmt(sizeof(Index)))), dynamic(dynamic) {
     wire(vbo);
     indexedBy(ibo);
     primitiveType(GL_TRIANGLES);
@@ -453,8 +706,11 @@ public:
   }
 
   void upload(const Vertex* vertices, const Index* indices, int numVertices, int numIndices) {
-    vbo->upload(vertices, numVertices, true);
-    ibo->upload(indices, numIndices, true);
+    if (numVertices - 1 > (int)std::numeric_limits<Index>::max())
+      throw std::runtime_error("SimpleIndexedGeometry: too many vertices for the index type, use IndexedGeometry instead");
+    vbo->upload(vertices, numVertices, dynamic);
+    ibo->upload(indices, numIndices, dynamic);
+    setBounds(computeBounds(vertices, numVertices));
   }
 
 private:
@@ -471,12 +727,55 @@ private:
 };
 
 
+// Indexed geometry taking 32-bit indices, e.g., from optimizeMesh of
+// meshoptimizer.h, and storing them in the narrowest index format that fits
+// the number of vertices. Pass dynamic = true for geometry that is uploaded
+// again every frame or so.
+template<typename Vertex>
+class IndexedGeometry : public BufferObjectGeometry {
+  std::shared_ptr<FormattedVbo> vbo;
+  std::shared_ptr<FormattedIbo> ibo;
+  bool dynamic;
+public:
+  IndexedGeometry(bool dynamic = false) : vbo(new FormattedVbo(Vertex::FORMAT)), dynamic(dynamic) {
+    wire(vbo);
+    primitiveType(GL_TRIANGLES);
+  }
+
+  IndexedGeometry(const Vertex* vertices, const unsigned int* indices, int numVertices, int numIndices, bool dynamic = false)
+    : vbo(new FormattedVbo(Vertex::FORMAT)), dynamic(dynamic) {
+    wire(vbo);
+    primitiveType(GL_TRIANGLES);
+    upload(vertices, indices, numVertices, numIndices);
+  }
+
+  void upload(const Vertex* vertices, const unsigned int* indices, int numVertices, int numIndices) {
+    const GLenum format = FormattedIbo::chooseFormat(numVertices);
+    if (!ibo || ibo->getIndexFormat() != format) {
+      ibo.reset(new FormattedIbo(format));
+      indexedBy(ibo);
+    }
+    vbo->upload(vertices, numVertices, dynamic);
+    ibo->uploadNarrowed(indices, numIndices, dynamic);
+    setBounds(computeBounds(vertices, numVertices));
+  }
+
+  GLenum getIndexFormat() const {
+    return ibo ? ibo->getIndexFormat() : GL_UNSIGNED_INT;
+  }
+};
+
 
 typedef SimpleUnindexedGeometry<VertexPN> SimpleGeometryPN;
 typedef SimpleUnindexedGeometry<VertexPNX> SimpleGeometryPNX;
 typedef SimpleUnindexedGeometry<VertexPNTBX> SimpleGeometryPNTBX;
+typedef SimpleUnindexedGeometry<VertexPackedPNTX> SimpleGeometryPackedPNTX;
 
 typedef SimpleIndexedGeometry<VertexPN, unsigned short> SimpleIndexedGeometryPN;
 typedef SimpleIndexedGeometry<VertexPNX, unsigned short> SimpleIndexedGeometryPNX;
 typedef SimpleIndexedGeometry<VertexPNTBX, unsigned short> SimpleIndexedGeometryPNTBX;
 
+typedef IndexedGeometry<VertexPN> IndexedGeometryPN;
+typedef IndexedGeometry<VertexPNX> IndexedGeometryPNX;
+typedef IndexedGeometry<VertexPNTBX> IndexedGeometryPNTBX;
+typedef IndexedGeometry<VertexPackedPNTX> IndexedGeometryPackedPNTX;
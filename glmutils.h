@@ -16,7 +16,7 @@
 
 static const double M_EPS = 1e-6;
 
-std::ostream &operator<<(std::ostream &out, const glm::mat4 &m)
+inline std::ostream &operator<<(std::ostream &out, const glm::mat4 &m)
 {
    const float *a = glm::value_ptr(m);
    for (int i = 0; i < 4; i++)
@@ -28,7 +28,7 @@ std::ostream &operator<<(std::ostream &out, const glm::mat4 &m)
    return out;
 }
 
-std::ostream &operator<<(std::ostream &out, const glm::mat3 &m)
+inline std::ostream &operator<<(std::ostream &out, const glm::mat3 &m)
 {
    const float *a = glm::value_ptr(m);
    for (int i = 0; i < 3; i++)
@@ -40,28 +40,90 @@ std::ostream &operator<<(std::ostream &out, const glm::mat3 &m)
    return out;
 }
 
-glm::mat4 transFact(const glm::mat4 &m)
+inline glm::mat4 transFact(const glm::mat4 &m)
 {
    glm::vec3 t = glm::vec3(m[3]);
    glm::mat4 result = glm::translate(t);
    return result;
 }
 
-glm::mat4 linFact(const glm::mat4 &m)
+inline glm::mat4 linFact(const glm::mat4 &m)
 {
    glm::mat3 lin = glm::mat3(m);
    glm::mat4 result = glm::mat4(lin);
    return result;
 }
 
-glm::mat4 normalMatrix(const glm::mat4 &m)
+inline glm::mat4 normalMatrix(const glm::mat4 &m)
 {
    glm::mat4 invm = glm::affineInverse(m);
    invm[3] = glm::vec4(0.0f);
    return glm::transpose(invm);
 }
 
-glm::mat4 makeProjection(const float fovy, const float aspectRatio, const float zNear, const float zFar)
+// Rigid body transform, i.e., a rotation followed by a translation: the matrix
+// T * R. Unlike with a general 4x4 matrix, composing, inverting and transforming
+// points cost a few quaternion operations. Convert it to a matrix with toMatrix()
+// only when sending it to the shaders.
+struct Rbt
+{
+   glm::quat r;   // unit quaternion
+   glm::vec3 t;
+
+   Rbt() : r(1, 0, 0, 0), t(0.0f) {}
+
+   explicit Rbt(const glm::vec3 &translation) : r(1, 0, 0, 0), t(translation) {}
+
+   explicit Rbt(const glm::quat &rotation) : r(rotation), t(0.0f) {}
+
+   Rbt(const glm::vec3 &translation, const glm::quat &rotation) : r(rotation), t(translation) {}
+
+   Rbt operator*(const Rbt &a) const
+   {
+      return Rbt(t + r * a.t, r * a.r);
+   }
+
+   glm::vec3 transformPoint(const glm::vec3 &p) const
+   {
+      return t + r * p;
+   }
+
+   glm::vec3 transformVector(const glm::vec3 &v) const
+   {
+      return r * v;
+   }
+
+   glm::mat4 toMatrix() const
+   {
+      glm::mat4 m = glm::mat4_cast(r);
+      m[3] = glm::vec4(t, 1.0f);
+      return m;
+   }
+};
+
+inline Rbt inv(const Rbt &a)
+{
+   const glm::quat invR = glm::conjugate(a.r);
+   return Rbt(-(invR * a.t), invR);
+}
+
+inline Rbt transFact(const Rbt &a)
+{
+   return Rbt(a.t);
+}
+
+inline Rbt linFact(const Rbt &a)
+{
+   return Rbt(a.r);
+}
+
+// The rotation itself, since the inverse transpose of a rotation is the rotation
+inline glm::mat4 normalMatrix(const Rbt &a)
+{
+   return glm::mat4_cast(a.r);
+}
+
+inline glm::mat4 makeProjection(const float fovy, const float aspectRatio, const float zNear, const float zFar)
 {
    // glm::perspective takes positive zNear and zfar, and flips 3rd row compared to textbook version
    glm::mat4 proj = glm::perspective(glm::radians(fovy), aspectRatio, -zNear, -zFar);
@@ -71,7 +133,7 @@ glm::mat4 makeProjection(const float fovy, const float aspectRatio, const float
 }
 
 // this is an alternative to the makeProjection() above
-glm::mat4 makeProjection2(const float fovy, const float aspectRatio, const float zNear, const float zFar)
+inline glm::mat4 makeProjection2(const float fovy, const float aspectRatio, const float zNear, const float zFar)
 {
    glm::mat4 r(0.0f);
    const double ang = fovy * 0.5 * M_PI / 180;
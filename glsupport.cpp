@@ -21,8 +21,73 @@ void checkGlErrors()
    }
 }
 
+GlStateCache &GlStateCache::getSingleton()
+{
+   // Never destroyed, as GL objects owned by other statics report their
+   // deletion to it during exit
+   static GlStateCache *cache = new GlStateCache();
+   return *cache;
+}
+
+GlStateCache::GlStateCache()
+   : numIssued_(0), numSkipped_(0)
+{
+   invalidate();
+}
+
+void GlStateCache::invalidate()
+{
+   program_ = vao_ = activeTexture_ = UNKNOWN;
+   for (int i = 0; i < MAX_TEXTURE_UNITS; ++i)
+      for (int j = 0; j < NUM_TEXTURE_TARGETS; ++j)
+         textures_[i][j] = UNKNOWN;
+   for (int i = 0; i < NUM_BUFFER_TARGETS; ++i)
+      buffers_[i] = UNKNOWN;
+   for (int i = 0; i < MAX_UNIFORM_BUFFER_BINDINGS; ++i)
+      uniformBuffers_[i] = UNKNOWN;
+   for (int i = 0; i < NUM_CAPS; ++i)
+      caps_[i] = UNKNOWN;
+   depthFunc_ = depthMask_ = blendSrc_ = blendDst_ = cullFace_ = polygonMode_ = UNKNOWN;
+}
+
+// Deleting a program that is in use only flags it for deletion, but its name
+// may be handed out again afterwards
+void GlStateCache::forgetProgram(GLuint program)
+{
+   if (program_ == program)
+      program_ = UNKNOWN;
+}
+
+// GL reverts the bindings of deleted objects to 0 in the current context
+void GlStateCache::forgetVertexArray(GLuint vao)
+{
+   if (vao_ == vao)
+   {
+      vao_ = 0;
+      buffers_[ELEMENT_ARRAY] = UNKNOWN;
+   }
+}
+
+void GlStateCache::forgetTexture(GLuint texture)
+{
+   for (int i = 0; i < MAX_TEXTURE_UNITS; ++i)
+      for (int j = 0; j < NUM_TEXTURE_TARGETS; ++j)
+         if (textures_[i][j] == texture)
+            textures_[i][j] = 0;
+}
+
+void GlStateCache::forgetBuffer(GLuint buffer)
+{
+   for (int i = 0; i < NUM_BUFFER_TARGETS; ++i)
+      if (buffers_[i] == buffer)
+         buffers_[i] = 0;
+   for (int i = 0; i < MAX_UNIFORM_BUFFER_BINDINGS; ++i)
+      if (uniformBuffers_[i] == buffer)
+         uniformBuffers_[i] = UNKNOWN;
+}
+
 // Dump text file into a character vector, throws exception on error
-static void readTextFile(const char *fn, vector<char> &data)
+void readTextFile(const char *fn, vector<char> &data)
 {
    // Sets ios::binary bit to prevent end of line translation, so that the
    // number of bytes we read equals file size
@@ -69,14 +134,17 @@ static void printShaderInfoLog(GLuint obj, const string &filename)
    }
 }
 
-static void compileShader(GLuint shaderHandle, int sourceLength, const char *source, const char *filenameHint)
+static void submitShader(GLuint shaderHandle, int sourceLength, const char *source)
 {
    const char *ptrs[] = {source};
    const GLint lens[] = {sourceLength};
    glShaderSource(shaderHandle, 1, ptrs, lens); // load the shader sources
 
    glCompileShader(shaderHandle);
+}
 
+void checkShaderCompiled(GLuint shaderHandle, const char *filenameHint)
+{
    printShaderInfoLog(shaderHandle, filenameHint);
 
    GLint compiled = 0;
@@ -85,29 +153,45 @@ static void compileShader(GLuint shaderHandle, int sourceLength, const char *sou
       throw runtime_error("fails to compile GL shader");
 }
 
+void submitSingleShaderFromMemory(GLuint shaderHandle, int sourceLength, const char *source)
+{
+   submitShader(shaderHandle, sourceLength, source);
+}
+
+void readAndSubmitSingleShader(GLuint shaderHandle, const char *fn)
+{
+   vector<char> source;
+   readTextFile(fn, source);
+   submitShader(shaderHandle, (int) source.size(), &source[0]);
+}
+
 void readAndCompileSingleShaderFromMemory(GLuint shaderHandle,
                                           int sourceLength, const char *source)
 {
-   compileShader(shaderHandle, sourceLength, source, "<in-memory source>");
+   submitShader(shaderHandle, sourceLength, source);
+   checkShaderCompiled(shaderHandle, "<in-memory source>");
 }
 
 void readAndCompileSingleShader(GLuint shaderHandle, const char *fn)
 {
-   vector<char> source;
-   readTextFile(fn, source);
-   compileShader(shaderHandle, (int) source.size(), &source[0], fn);
+   readAndSubmitSingleShader(shaderHandle, fn);
+   checkShaderCompiled(shaderHandle, fn);
 }
 
-void linkShader(GLuint programHandle, GLuint vs, GLuint fs)
+void submitLinkShader(GLuint programHandle, GLuint vs, GLuint fs)
 {
    glAttachShader(programHandle, vs);
    glAttachShader(programHandle, fs);
 
    glLinkProgram(programHandle);
 
+   // The link uses the shaders attached at the time of the call
    glDetachShader(programHandle, vs);
    glDetachShader(programHandle, fs);
+}
 
+void checkShaderLinked(GLuint programHandle)
+{
    GLint linked = 0;
    glGetProgramiv(programHandle, GL_LINK_STATUS, &linked);
    printProgramInfoLog(programHandle, "linking");
@@ -116,6 +200,28 @@ void linkShader(GLuint programHandle, GLuint vs, GLuint fs)
       throw runtime_error("fails to link shaders");
 }
 
+void linkShader(GLuint programHandle, GLuint vs, GLuint fs)
+{
+   submitLinkShader(programHandle, vs, fs);
+   checkShaderLinked(programHandle);
+}
+
+void enableParallelShaderCompile()
+{
+   // Let the driver pick the number of threads
+   if (GLEW_KHR_parallel_shader_compile)
+      glMaxShaderCompilerThreadsKHR(0xffffffff);
+}
+
+bool isShaderLinkCompleted(GLuint programHandle)
+{
+   if (!GLEW_KHR_parallel_shader_compile)
+      return true;
+   GLint completed = 0;
+   glGetProgramiv(programHandle, GL_COMPLETION_STATUS_KHR, &completed);
+   return completed != 0;
+}
+
 void readAndCompileShader(GLuint programHandle, const char *vertexShaderFileName, const char *fragmentShaderFileName)
 {
    GlShader vs(GL_VERTEX_SHADER);
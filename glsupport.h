@@ -5,6 +5,7 @@
 
 #include <iostream>
 #include <stdexcept>
+#include <vector>
 
 #include <GL/glew.h>
 
@@ -17,6 +18,9 @@ void checkGlErrors();
 void readAndCompileShader(GLuint programHandle,
                           const char *vertexShaderFileName, const char *fragmentShaderFileName);
 
+// Dumps a text file into a character vector. Throws runtime_error on error
+void readTextFile(const char *fileName, std::vector<char> &data);
+
 // Read and compile a pair of vertex shader and fragment shader source codes from
 // memory into a GL shader program. Throws runtime_error on error
 void readAndCompileShaderFromMemory(GLuint programHandle,
@@ -35,6 +39,25 @@ void readAndCompileSingleShader(GLuint shaderHandle, const char *shaderFileName)
 void readAndCompileSingleShaderFromMemory(GLuint shaderHandle,
                                           int sourceLength, const char *source);
 
+// Deferred variants of the above, for building many programs at once: shaders and
+// programs are all submitted first, and their status is queried afterwards, so that
+// the driver may compile them in parallel (see enableParallelShaderCompile()).
+// The check functions throw runtime_error on error.
+void readAndSubmitSingleShader(GLuint shaderHandle, const char *shaderFileName);
+void submitSingleShaderFromMemory(GLuint shaderHandle, int sourceLength, const char *source);
+void checkShaderCompiled(GLuint shaderHandle, const char *filenameHint);
+void submitLinkShader(GLuint programHandle, GLuint vertexShaderHandle, GLuint fragmentShaderHandle);
+void checkShaderLinked(GLuint programHandle);
+
+// Lets the driver compile and link on its own threads, if it supports
+// GL_KHR_parallel_shader_compile
+void enableParallelShaderCompile();
+
+// False while the driver is still compiling or linking the program on its own
+// threads, so that querying its status would wait. Always true without
+// GL_KHR_parallel_shader_compile.
+bool isShaderLinkCompleted(GLuint programHandle);
+
 // Classes inheriting Noncopyable will not have default compiler generated copy
 // constructor and assignment operator
 class Noncopyable
@@ -48,6 +71,286 @@ private:
    const Noncopyable &operator=(const Noncopyable &);
 };
 
+// Process-wide shadow of the GL bindings and capabilities that the wrappers in
+// this code base change: the current program and vertex array object, texture
+// bindings of each unit, buffer bindings, depth, blend, cull and polygon
+// state, and a few glEnable flags. Requests for a state that is already set are
+// skipped instead of reaching the driver. Both issued and skipped calls are
+// counted.
+//
+// Everything starts out unknown, so the first request for each state is always
+// issued. Code that changes these states directly should call invalidate()
+// afterwards. The GL object wrappers below report deleted objects, so that a
+// name recycled by GL is never mistaken for a binding that is still current.
+class GlStateCache : Noncopyable
+{
+public:
+   static GlStateCache &getSingleton();
+
+   void useProgram(GLuint program)
+   {
+      if (!changed(program_, program))
+         return;
+      ::glUseProgram(program);
+   }
+
+   // Also forgets the element array buffer binding, which belongs to the vertex array
+   void bindVertexArray(GLuint vao)
+   {
+      if (!changed(vao_, vao))
+         return;
+      ::glBindVertexArray(vao);
+      buffers_[ELEMENT_ARRAY] = UNKNOWN;
+   }
+
+   // `unit' is the index of the texture unit, not GL_TEXTURE0 + index
+   void activeTexture(unsigned int unit)
+   {
+      if (!changed(activeTexture_, unit))
+         return;
+      ::glActiveTexture(GL_TEXTURE0 + unit);
+   }
+
+   // Binds the texture to the active texture unit
+   void bindTexture(GLenum target, GLuint texture)
+   {
+      const int t = getTextureTargetIndex(target);
+      if (t < 0 || activeTexture_ >= MAX_TEXTURE_UNITS)
+      {
+         ++numIssued_;
+         ::glBindTexture(target, texture);
+         return;
+      }
+      if (!changed(textures_[activeTexture_][t], texture))
+         return;
+      ::glBindTexture(target, texture);
+   }
+
+   void bindBuffer(GLenum target, GLuint buffer)
+   {
+      const int t = getBufferTargetIndex(target);
+      if (t < 0)
+      {
+         ++numIssued_;
+         ::glBindBuffer(target, buffer);
+         return;
+      }
+      if (!changed(buffers_[t], buffer))
+         return;
+      ::glBindBuffer(target, buffer);
+   }
+
+   // Only GL_UNIFORM_BUFFER bindings are shadowed. Like glBindBufferBase, also
+   // binds the buffer to the generic binding point of `target'.
+   void bindBufferBase(GLenum target, GLuint index, GLuint buffer)
+   {
+      if (target != GL_UNIFORM_BUFFER || index >= MAX_UNIFORM_BUFFER_BINDINGS)
+      {
+         ++numIssued_;
+         ::glBindBufferBase(target, index, buffer);
+         return;
+      }
+      if (!changedUniformBuffer(index, buffer, 0, WHOLE_BUFFER))
+         return;
+      ::glBindBufferBase(target, index, buffer);
+      buffers_[UNIFORM] = buffer;
+   }
+
+   // Same as bindBufferBase, for `size' bytes of the buffer from `offset'
+   void bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+   {
+      if (target != GL_UNIFORM_BUFFER || index >= MAX_UNIFORM_BUFFER_BINDINGS)
+      {
+         ++numIssued_;
+         ::glBindBufferRange(target, index, buffer, offset, size);
+         return;
+      }
+      if (!changedUniformBuffer(index, buffer, offset, size))
+         return;
+      ::glBindBufferRange(target, index, buffer, offset, size);
+      buffers_[UNIFORM] = buffer;
+   }
+
+   // Calls glEnable or glDisable
+   void setEnabled(GLenum cap, bool enabled)
+   {
+      const int c = getCapIndex(cap);
+      if (c < 0)
+      {
+         ++numIssued_;
+         enabled ? ::glEnable(cap) : ::glDisable(cap);
+         return;
+      }
+      if (!changed(caps_[c], enabled ? 1u : 0u))
+         return;
+      enabled ? ::glEnable(cap) : ::glDisable(cap);
+   }
+
+   void depthFunc(GLenum func)
+   {
+      if (changed(depthFunc_, func))
+         ::glDepthFunc(func);
+   }
+
+   void depthMask(GLboolean flag)
+   {
+      if (changed(depthMask_, flag ? 1u : 0u))
+         ::glDepthMask(flag);
+   }
+
+   void blendFunc(GLenum sfactor, GLenum dfactor)
+   {
+      if (blendSrc_ == sfactor && blendDst_ == dfactor)
+      {
+         ++numSkipped_;
+         return;
+      }
+      ++numIssued_;
+      blendSrc_ = sfactor;
+      blendDst_ = dfactor;
+      ::glBlendFunc(sfactor, dfactor);
+   }
+
+   void cullFace(GLenum mode)
+   {
+      if (changed(cullFace_, mode))
+         ::glCullFace(mode);
+   }
+
+   // Only GL_FRONT_AND_BACK is supported by the core profile
+   void polygonMode(GLenum mode)
+   {
+      if (changed(polygonMode_, mode))
+         ::glPolygonMode(GL_FRONT_AND_BACK, mode);
+   }
+
+   // To be called by the wrappers when objects are deleted
+   void forgetProgram(GLuint program);
+   void forgetVertexArray(GLuint vao);
+   void forgetTexture(GLuint texture);
+   void forgetBuffer(GLuint buffer);
+
+   // Marks all states unknown
+   void invalidate();
+
+   unsigned long getNumIssued() const
+   {
+      return numIssued_;
+   }
+
+   unsigned long getNumSkipped() const
+   {
+      return numSkipped_;
+   }
+
+   void resetCounters()
+   {
+      numIssued_ = numSkipped_ = 0;
+   }
+
+private:
+   enum
+   {
+      MAX_TEXTURE_UNITS = 32,
+      NUM_TEXTURE_TARGETS = 2,
+      MAX_UNIFORM_BUFFER_BINDINGS = 36,
+      NUM_CAPS = 5
+   };
+   enum BufferTarget
+   {
+      ARRAY,
+      ELEMENT_ARRAY,
+      PIXEL_UNPACK,
+      UNIFORM,
+      NUM_BUFFER_TARGETS
+   };
+
+   static const GLuint UNKNOWN = ~0u;
+   static const GLsizeiptr WHOLE_BUFFER = -1;
+
+   GLuint program_, vao_, activeTexture_;
+   GLuint textures_[MAX_TEXTURE_UNITS][NUM_TEXTURE_TARGETS];
+   GLuint buffers_[NUM_BUFFER_TARGETS];
+   GLuint uniformBuffers_[MAX_UNIFORM_BUFFER_BINDINGS];
+   GLintptr uniformBufferOffsets_[MAX_UNIFORM_BUFFER_BINDINGS];
+   GLsizeiptr uniformBufferSizes_[MAX_UNIFORM_BUFFER_BINDINGS];   // WHOLE_BUFFER for glBindBufferBase
+   GLuint caps_[NUM_CAPS];
+   GLuint depthFunc_, depthMask_, blendSrc_, blendDst_, cullFace_, polygonMode_;
+
+   unsigned long numIssued_, numSkipped_;
+
+   GlStateCache();
+
+   // Updates `current' and returns true if the call has to be issued
+   bool changed(GLuint &current, GLuint value)
+   {
+      if (current == value)
+      {
+         ++numSkipped_;
+         return false;
+      }
+      ++numIssued_;
+      current = value;
+      return true;
+   }
+
+   bool changedUniformBuffer(GLuint index, GLuint buffer, GLintptr offset, GLsizeiptr size)
+   {
+      if (uniformBuffers_[index] == buffer && uniformBufferOffsets_[index] == offset &&
+          uniformBufferSizes_[index] == size)
+      {
+         ++numSkipped_;
+         return false;
+      }
+      ++numIssued_;
+      uniformBuffers_[index] = buffer;
+      uniformBufferOffsets_[index] = offset;
+      uniformBufferSizes_[index] = size;
+      return true;
+   }
+
+   static int getTextureTargetIndex(GLenum target)
+   {
+      return target == GL_TEXTURE_2D ? 0 : (target == GL_TEXTURE_CUBE_MAP ? 1 : -1);
+   }
+
+   static int getBufferTargetIndex(GLenum target)
+   {
+      switch (target)
+      {
+      case GL_ARRAY_BUFFER:
+         return ARRAY;
+      case GL_ELEMENT_ARRAY_BUFFER:
+         return ELEMENT_ARRAY;
+      case GL_PIXEL_UNPACK_BUFFER:
+         return PIXEL_UNPACK;
+      case GL_UNIFORM_BUFFER:
+         return UNIFORM;
+      default:
+         return -1;
+      }
+   }
+
+   static int getCapIndex(GLenum cap)
+   {
+      switch (cap)
+      {
+      case GL_BLEND:
+         return 0;
+      case GL_CULL_FACE:
+         return 1;
+      case GL_DEPTH_TEST:
+         return 2;
+      case GL_FRAMEBUFFER_SRGB:
+         return 3;
+      case GL_MULTISAMPLE:
+         return 4;
+      default:
+         return -1;
+      }
+   }
+};
+
 // Light wrapper around a GL shader (can be geometry/vertex/fragment shader)
 // handle. Automatically allocates and deallocates. Can be casted to GLuint.
 class GlShader : Noncopyable
@@ -94,6 +397,7 @@ public:
 
    ~GlProgram()
    {
+      GlStateCache::getSingleton().forgetProgram(handle_);
       glDeleteProgram(handle_);
    }
 
@@ -120,6 +424,7 @@ public:
 
    ~GlTexture()
    {
+      GlStateCache::getSingleton().forgetTexture(handle_);
       glDeleteTextures(1, &handle_);
    }
 
@@ -146,6 +451,7 @@ public:
 
    ~GlBufferObject()
    {
+      GlStateCache::getSingleton().forgetBuffer(handle_);
       glDeleteBuffers(1, &handle_);
    }
 
@@ -172,6 +478,7 @@ public:
 
    ~GlArrayObject()
    {
+      GlStateCache::getSingleton().forgetVertexArray(handle_);
       glDeleteVertexArrays(1, &handle_);
    }
 
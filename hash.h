@@ -0,0 +1,21 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <cstddef>
+#include <cstdint>
+
+// 64-bit FNV-1a hash of a block of memory. Pass the result of a previous call as
+// `seed' to hash several blocks as if they were one.
+inline uint64_t fnv1aHash(const void *data, size_t size, uint64_t seed = 14695981039346656037ULL)
+{
+   const unsigned char *p = static_cast<const unsigned char *>(data);
+   uint64_t h = seed;
+   for (size_t i = 0; i < size; ++i)
+   {
+      h ^= p[i];
+      h *= 1099511628211ULL;
+   }
+   return h;
+}
+
+#endif
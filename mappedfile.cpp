@@ -0,0 +1,100 @@
+#include <string>
+#include <stdexcept>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "mappedfile.h"
+
+using namespace std;
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const char *filename)
+  : data_(NULL), size_(0), fileHandle_(INVALID_HANDLE_VALUE), mappingHandle_(NULL) {
+  HANDLE file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    throw runtime_error(string("MappedFile: Cannot open file ") + filename);
+
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size)) {
+    CloseHandle(file);
+    throw runtime_error(string("MappedFile: Cannot stat file ") + filename);
+  }
+  fileHandle_ = file;
+  size_ = (size_t)size.QuadPart;
+
+  if (size_ == 0)
+    return;
+
+  mappingHandle_ = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mappingHandle_ != NULL)
+    data_ = static_cast<const char *>(MapViewOfFile(mappingHandle_, FILE_MAP_READ, 0, 0, 0));
+
+  if (data_ == NULL) {
+    if (mappingHandle_ != NULL)
+      CloseHandle(mappingHandle_);
+    CloseHandle(file);
+    throw runtime_error(string("MappedFile: Cannot map file ") + filename);
+  }
+}
+
+MappedFile::~MappedFile() {
+  if (data_)
+    UnmapViewOfFile(data_);
+  if (mappingHandle_ != NULL)
+    CloseHandle(mappingHandle_);
+  if (fileHandle_ != INVALID_HANDLE_VALUE)
+    CloseHandle(fileHandle_);
+}
+
+void MappedFile::willNeed() const {}
+
+#else
+
+MappedFile::MappedFile(const char *filename)
+  : data_(NULL), size_(0) {
+  const int fd = ::open(filename, O_RDONLY);
+  if (fd < 0)
+    throw runtime_error(string("MappedFile: Cannot open file ") + filename);
+
+  struct stat st;
+  if (::fstat(fd, &st) != 0) {
+    ::close(fd);
+    throw runtime_error(string("MappedFile: Cannot stat file ") + filename);
+  }
+  size_ = (size_t)st.st_size;
+
+  if (size_ > 0) {
+    void *p = ::mmap(NULL, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+      ::close(fd);
+      throw runtime_error(string("MappedFile: Cannot map file ") + filename);
+    }
+    data_ = static_cast<const char *>(p);
+  }
+
+  // The mapping stays valid after the descriptor is closed
+  ::close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (data_)
+    ::munmap(const_cast<char *>(data_), size_);
+}
+
+void MappedFile::willNeed() const {
+  if (data_)
+    ::madvise(const_cast<char *>(data_), size_, MADV_WILLNEED);
+}
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <cstddef>
+
+// Read-only memory mapping of a whole file. The mapping is released when the
+// object is destroyed. Throws runtime_error if the file cannot be opened or mapped.
+//
+// On POSIX systems this uses mmap, on Windows CreateFileMapping/MapViewOfFile.
+class MappedFile {
+public:
+  explicit MappedFile(const char *filename);
+  ~MappedFile();
+
+  // Pointer to the first byte of the file. NULL for an empty file.
+  const char *data() const {
+    return data_;
+  }
+
+  // Size of the file in bytes
+  size_t size() const {
+    return size_;
+  }
+
+  // Hint the OS that the whole file is about to be read sequentially
+  void willNeed() const;
+
+private:
+  const char *data_;
+  size_t size_;
+
+#ifdef _WIN32
+  void *fileHandle_;
+  void *mappingHandle_;
+#endif
+
+  MappedFile(const MappedFile &);
+  const MappedFile &operator=(const MappedFile &);
+};
+
+#endif
@@ -1,4 +1,7 @@
 #include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <algorithm>
 #include <string>
 #include <vector>
@@ -6,15 +9,23 @@
 
 #include "glsupport.h"
 #include "material.h"
+#include "programcache.h"
+#include "uniformblock.h"
 
 using namespace std;
 
+// Name of the uniform block whose members are supplied by the Material's own uniforms
+static const char MATERIAL_BLOCK_NAME[] = "MaterialBlock";
+
 struct GlProgramDesc {
   struct UniformDesc {
     string name;
     GLenum type;
     GLint size;
     GLint location;
+
+    // Interned name, and for arrays reported as blah[0] the interned `blah' (-1 otherwise)
+    int id, arrayId;
   };
 
   struct AttribDesc {
@@ -25,17 +36,67 @@ struct GlProgramDesc {
   };
 
   GlProgram program;
-  GlArrayObject vao;
 
-  vector<UniformDesc> uniforms;
+  // Number of programs created before this one, for sorting draws
+  unsigned int sortId;
+
+  vector<UniformDesc> uniforms;    // excluding the ones in uniform blocks
   vector<AttribDesc> attribs;
 
-  GlProgramDesc(GLuint vsHandle, GLuint fsHandle) {
-    linkShader(program, vsHandle, fsHandle);
+  // Layout of the block filled from the material uniforms, NULL if the program has none
+  shared_ptr<const UniformBlockLayout> materialBlock;
 
-    int numActiveUniforms, numActiveAttribs, uniformMaxLen, attribMaxLen;
+  // All blocks of the program, by block index
+  vector<shared_ptr<const UniformBlockLayout> > blocks;
+
+  // Set while the link submitted by GlProgramLibrary may still be running
+  struct PendingLink {
+    shared_ptr<GlShader> vs, fs;
+    string vsFilename, fsFilename;
+    string cacheFileName;    // empty if the binary is not to be cached
+    uint64_t cacheKey;
+  };
+  unique_ptr<PendingLink> pendingLink;
+
+  // The program is then linked from shaders or loaded from a binary, and described
+  // by finishLink() or deserialize() respectively
+  GlProgramDesc() {
+    static unsigned int numPrograms = 0;
+    sortId = numPrograms++;
+  }
+
+  // Waits for the pending link if any, then describes the program. Throws
+  // runtime_error if a shader failed to compile or the program to link.
+  void finishLink() {
+    if (!pendingLink)
+      return;
+
+    // Once the link is done the compiles are too, so the first check is the only wait
+    checkShaderCompiled(*pendingLink->vs, pendingLink->vsFilename.c_str());
+    checkShaderCompiled(*pendingLink->fs, pendingLink->fsFilename.c_str());
+    checkShaderLinked(program);
+
+    reflect();
+    if (!pendingLink->cacheFileName.empty())
+      saveProgramBinary(pendingLink->cacheFileName, pendingLink->cacheKey, program, serialize());
+    pendingLink.reset();
+  }
+
+  // True once the program can be drawn with. While the driver is still linking
+  // it in the background, returns false instead of waiting like finishLink().
+  bool pollLink() {
+    if (pendingLink && !isShaderLinkCompleted(program))
+      return false;
+    finishLink();
+    return true;
+  }
+
+  // Queries the description of the linked program
+  void reflect() {
+    int numActiveUniforms, numActiveAttribs, numActiveUniformBlocks, uniformMaxLen, attribMaxLen;
 
     glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &numActiveUniforms);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &numActiveUniformBlocks);
     glGetProgramiv(program, GL_ACTIVE_ATTRIBUTES, &numActiveAttribs);
 
     glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &uniformMaxLen);
@@ -44,14 +105,51 @@ struct GlProgramDesc {
     const int bufSize = max(uniformMaxLen, attribMaxLen) + 1;
     vector<GLchar> buffer(bufSize);
 
-    uniforms.resize(numActiveUniforms);
+    // Uniforms inside blocks are described by the block layouts instead
+    vector<shared_ptr<UniformBlockLayout> > layouts(numActiveUniformBlocks);
+    for (int i = 0; i < numActiveUniformBlocks; ++i) {
+      GLint nameLen;
+      glGetActiveUniformBlockiv(program, i, GL_UNIFORM_BLOCK_NAME_LENGTH, &nameLen);
+      vector<GLchar> blockName(nameLen + 1);
+      GLsizei charsWritten;
+      glGetActiveUniformBlockName(program, i, nameLen + 1, &charsWritten, &blockName[0]);
+
+      layouts[i].reset(new UniformBlockLayout());
+      layouts[i]->name = string(blockName.begin(), blockName.begin() + charsWritten);
+      glGetActiveUniformBlockiv(program, i, GL_UNIFORM_BLOCK_DATA_SIZE, &layouts[i]->dataSize);
+    }
+
+    uniforms.clear();
+    uniforms.reserve(numActiveUniforms);
     for (int i = 0; i < numActiveUniforms; ++i) {
+      UniformDesc ud;
       GLsizei charsWritten;
-      glGetActiveUniform(program, i, bufSize, &charsWritten, & (uniforms[i].size), & (uniforms[i].type), &buffer[0]);
+      glGetActiveUniform(program, i, bufSize, &charsWritten, &ud.size, &ud.type, &buffer[0]);
       assert(charsWritten + 1 <= bufSize);
-      uniforms[i].name = string(buffer.begin(), buffer.begin() + charsWritten);
-      uniforms[i].location = glGetUniformLocation(program, &buffer[0]);
+      ud.name = string(buffer.begin(), buffer.begin() + charsWritten);
+      ud.location = glGetUniformLocation(program, &buffer[0]);
+      internName(ud.name, ud.id, ud.arrayId);
+
+      const GLuint index = i;
+      GLint blockIndex;
+      glGetActiveUniformsiv(program, 1, &index, GL_UNIFORM_BLOCK_INDEX, &blockIndex);
+      if (blockIndex < 0) {
+        uniforms.push_back(ud);
+        continue;
+      }
+
+      UniformBlockLayout::Member m;
+      m.name = ud.name;
+      m.id = ud.id;
+      m.arrayId = ud.arrayId;
+      m.type = ud.type;
+      m.size = ud.size;
+      glGetActiveUniformsiv(program, 1, &index, GL_UNIFORM_OFFSET, &m.offset);
+      glGetActiveUniformsiv(program, 1, &index, GL_UNIFORM_ARRAY_STRIDE, &m.arrayStride);
+      glGetActiveUniformsiv(program, 1, &index, GL_UNIFORM_MATRIX_STRIDE, &m.matrixStride);
+      layouts[blockIndex]->members.push_back(m);
     }
+    blocks.assign(layouts.begin(), layouts.end());
 
     attribs.resize(numActiveAttribs);
     for (int i = 0; i < numActiveAttribs; ++i) {
@@ -62,10 +160,145 @@ struct GlProgramDesc {
       attribs[i].location = glGetAttribLocation(program, &buffer[0]);
     }
 
+    bindBlocks();
+  }
+
+  // Writes the description for the program cache. Interned ids are per process,
+  // hence only the names are saved.
+  string serialize() const {
+    string out;
+    write(out, uint32_t(uniforms.size()));
+    for (size_t i = 0; i < uniforms.size(); ++i) {
+      write(out, uniforms[i].name);
+      write(out, uniforms[i].type);
+      write(out, uniforms[i].size);
+      write(out, uniforms[i].location);
+    }
+    write(out, uint32_t(attribs.size()));
+    for (size_t i = 0; i < attribs.size(); ++i) {
+      write(out, attribs[i].name);
+      write(out, attribs[i].type);
+      write(out, attribs[i].size);
+      write(out, attribs[i].location);
+    }
+    write(out, uint32_t(blocks.size()));
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      write(out, blocks[i]->name);
+      write(out, blocks[i]->dataSize);
+      write(out, uint32_t(blocks[i]->members.size()));
+      for (size_t j = 0; j < blocks[i]->members.size(); ++j) {
+        const UniformBlockLayout::Member& m = blocks[i]->members[j];
+        write(out, m.name);
+        write(out, m.type);
+        write(out, m.size);
+        write(out, m.offset);
+        write(out, m.arrayStride);
+        write(out, m.matrixStride);
+      }
+    }
+    return out;
+  }
+
+  // Reads the description written by serialize(), returns false if it is corrupt
+  bool deserialize(const string& in) {
+    size_t pos = 0;
+    uint32_t n = 0;
+    if (!read(in, pos, n) || n > in.size())
+      return false;
+    uniforms.resize(n);
+    for (size_t i = 0; i < uniforms.size(); ++i) {
+      UniformDesc& ud = uniforms[i];
+      if (!read(in, pos, ud.name) || !read(in, pos, ud.type) || !read(in, pos, ud.size) || !read(in, pos, ud.location))
+        return false;
+      internName(ud.name, ud.id, ud.arrayId);
+    }
+
+    if (!read(in, pos, n) || n > in.size())
+      return false;
+    attribs.resize(n);
+    for (size_t i = 0; i < attribs.size(); ++i) {
+      AttribDesc& ad = attribs[i];
+      if (!read(in, pos, ad.name) || !read(in, pos, ad.type) || !read(in, pos, ad.size) || !read(in, pos, ad.location))
+        return false;
+    }
+
+    if (!read(in, pos, n) || n > in.size())
+      return false;
+    vector<shared_ptr<UniformBlockLayout> > layouts(n);
+    for (size_t i = 0; i < layouts.size(); ++i) {
+      layouts[i].reset(new UniformBlockLayout());
+      uint32_t numMembers = 0;
+      if (!read(in, pos, layouts[i]->name) || !read(in, pos, layouts[i]->dataSize) ||
+          !read(in, pos, numMembers) || numMembers > in.size())
+        return false;
+      layouts[i]->members.resize(numMembers);
+      for (size_t j = 0; j < numMembers; ++j) {
+        UniformBlockLayout::Member& m = layouts[i]->members[j];
+        if (!read(in, pos, m.name) || !read(in, pos, m.type) || !read(in, pos, m.size) ||
+            !read(in, pos, m.offset) || !read(in, pos, m.arrayStride) || !read(in, pos, m.matrixStride))
+          return false;
+        internName(m.name, m.id, m.arrayId);
+      }
+    }
+    if (pos != in.size())
+      return false;
+    blocks.assign(layouts.begin(), layouts.end());
+
+    bindBlocks();
+    return true;
+  }
+
+private:
+  // Linking and loading a binary both reset the uniform block bindings
+  void bindBlocks() {
+    materialBlock.reset();
+    for (size_t i = 0; i < blocks.size(); ++i) {
+      glUniformBlockBinding(program, i, UniformBlock::getBindingPoint(blocks[i]->name));
+      if (blocks[i]->name == MATERIAL_BLOCK_NAME)
+        materialBlock = blocks[i];
+      else
+        UniformBlock::registerLayout(blocks[i]);
+    }
+
     glBindFragDataLocation(program, 0, "fragColor");
 
     checkGlErrors();
   }
+
+  static void internName(const string& name, int& id, int& arrayId) {
+    id = UniformName(name).getId();
+    arrayId = -1;
+    if (name.length() >= 3 && name.compare(name.length() - 3, 3, "[0]") == 0)
+      arrayId = UniformName(name.substr(0, name.length() - 3)).getId();
+  }
+
+  template<typename T>
+  static void write(string& out, T value) {
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+  }
+
+  static void write(string& out, const string& value) {
+    write(out, uint32_t(value.size()));
+    out.append(value);
+  }
+
+  template<typename T>
+  static bool read(const string& in, size_t& pos, T& value) {
+    if (in.size() - pos < sizeof(value))
+      return false;
+    memcpy(&value, in.data() + pos, sizeof(value));
+    pos += sizeof(value);
+    return true;
+  }
+
+  static bool read(const string& in, size_t& pos, string& value) {
+    uint32_t len;
+    if (!read(in, pos, len) || in.size() - pos < len)
+      return false;
+    value.assign(in, pos, len);
+    pos += len;
+    return true;
+  }
 };
 
 class GlProgramLibrary {
@@ -77,7 +310,9 @@ class GlProgramLibrary {
   GlShaderMap shaderMap;
   GlProgramDescMap programMap;
 
-  GlProgramLibrary() {}
+  GlProgramLibrary() {
+    enableParallelShaderCompile();
+  }
 
 public:
   static GlProgramLibrary& getSingleton() {
@@ -90,7 +325,7 @@ public:
 
     GlProgramDescMap::iterator i = programMap.find(key);
     if (i == programMap.end()) {
-      shared_ptr<GlProgramDesc> program(new GlProgramDesc(*getShader(vsFilename, GL_VERTEX_SHADER), *getShader(fsFilename, GL_FRAGMENT_SHADER)));
+      shared_ptr<GlProgramDesc> program = buildProgramDesc(vsFilename, fsFilename);
       programMap[key] = program;
       return program;
     }
@@ -99,6 +334,23 @@ public:
     }
   }
 
+  // Finishes the links of all programs created so far
+  void finishPrograms() {
+    for (GlProgramDescMap::iterator i = programMap.begin(); i != programMap.end(); ++i)
+      i->second->finishLink();
+  }
+
+  // Finishes the links the driver completed, without waiting for the others.
+  // Returns the number of programs still linking.
+  int pollPrograms() {
+    int numPending = 0;
+    for (GlProgramDescMap::iterator i = programMap.begin(); i != programMap.end(); ++i) {
+      if (!i->second->pollLink())
+        ++numPending;
+    }
+    return numPending;
+  }
+
   void addInlineSource(const string& filename, int length, const char* content) {
     fileMap[filename].assign(content, content + length);
   }
@@ -108,6 +360,48 @@ public:
   }
 
 protected:
+  // Loads the program from the binary cache, or submits the shaders and the link
+  // of the program, to be finished by GlProgramDesc::finishLink()
+  shared_ptr<GlProgramDesc> buildProgramDesc(const string& vsFilename, const string& fsFilename) {
+    shared_ptr<GlProgramDesc> desc(new GlProgramDesc());
+    unique_ptr<GlProgramDesc::PendingLink> link(new GlProgramDesc::PendingLink());
+    link->cacheKey = 0;
+
+    if (isProgramBinaryCacheSupported()) {
+      link->cacheKey = getProgramCacheKey(getSource(vsFilename), getSource(fsFilename));
+      link->cacheFileName = getCacheFileName(vsFilename, link->cacheKey);
+      string reflection;
+      if (loadProgramBinary(link->cacheFileName, link->cacheKey, desc->program, reflection) && desc->deserialize(reflection))
+        return desc;
+      glProgramParameteri(desc->program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    link->vs = getShader(vsFilename, GL_VERTEX_SHADER);
+    link->fs = getShader(fsFilename, GL_FRAGMENT_SHADER);
+    link->vsFilename = vsFilename;
+    link->fsFilename = fsFilename;
+    submitLinkShader(desc->program, *link->vs, *link->fs);
+    desc->pendingLink = move(link);
+    return desc;
+  }
+
+  vector<char> getSource(const string& filename) {
+    FileMap::iterator contentIter = fileMap.find(filename);
+    if (contentIter != fileMap.end())
+      return contentIter->second;
+    vector<char> source;
+    readTextFile(filename.c_str(), source);
+    return source;
+  }
+
+  // Cache files go next to the vertex shader, named by the key
+  static string getCacheFileName(const string& vsFilename, uint64_t key) {
+    const size_t slash = vsFilename.find_last_of("/\\");
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.glprog", (unsigned long long)key);
+    return (slash == string::npos ? string() : vsFilename.substr(0, slash + 1)) + name;
+  }
+
   shared_ptr<GlShader> getShader(const string& filename, GLenum shaderType) {
     string f = filename;
 
@@ -118,9 +412,9 @@ protected:
 
       FileMap::iterator contentIter = fileMap.find(f);
       if (contentIter == fileMap.end())
-        readAndCompileSingleShader(*shader, f.c_str());
+        readAndSubmitSingleShader(*shader, f.c_str());
       else
-        readAndCompileSingleShaderFromMemory(*shader, contentIter->second.size(), &contentIter->second[0]);
+        submitSingleShaderFromMemory(*shader, contentIter->second.size(), &contentIter->second[0]);
 
       shaderMap[key] = shader;
       return shader;
@@ -139,12 +433,64 @@ void Material::removeInlineSource(const std::string& filename) {
   GlProgramLibrary::getSingleton().removeInlineSource(filename);
 }
 
+void Material::finishPrograms() {
+  GlProgramLibrary::getSingleton().finishPrograms();
+}
+
+int Material::pollPrograms() {
+  return GlProgramLibrary::getSingleton().pollPrograms();
+}
+
 
 
 Material::Material(const string& vsFilename, const string& fsFilename)
-  : programDesc_(GlProgramLibrary::getSingleton().getProgramDesc(vsFilename, fsFilename))
+  : programDesc_(GlProgramLibrary::getSingleton().getProgramDesc(vsFilename, fsFilename)),
+    materialBlockChangeCount_(0), textureSetId_(0), textureSetChangeCount_(uniforms_.changeCount_ - 1)
+{}
+
+Material::Material(const Material& m)
+  : programDesc_(m.programDesc_), uniformPlans_(m.uniformPlans_), uniforms_(m.uniforms_),
+    materialBlockChangeCount_(0), textureSetId_(m.textureSetId_), textureSetChangeCount_(m.textureSetChangeCount_),
+    renderStates_(m.renderStates_)
 {}
 
+Material& Material::operator= (const Material& m) {
+  programDesc_ = m.programDesc_;
+  uniformPlans_ = m.uniformPlans_;
+  uniforms_ = m.uniforms_;
+  materialBlock_.reset();
+  textureSetId_ = m.textureSetId_;
+  textureSetChangeCount_ = m.textureSetChangeCount_;
+  renderStates_ = m.renderStates_;
+  return *this;
+}
+
+unsigned int Material::getProgramSortId() const {
+  return programDesc_->sortId;
+}
+
+unsigned int Material::getTextureSetId() {
+  if (textureSetChangeCount_ == uniforms_.changeCount_)
+    return textureSetId_;
+
+  vector<const Texture*> textures;
+  for (const Uniforms::Value *v = uniforms_.values_.begin(); v != uniforms_.values_.end(); ++v) {
+    const shared_ptr<Texture> *tex = uniforms_.getTextures(*v);
+    for (int i = 0; tex && i < v->size; ++i)
+      textures.push_back(tex[i].get());
+  }
+
+  // Textures sets are numbered in order of first appearance
+  static map<vector<const Texture*>, unsigned int> textureSetIds;
+  map<vector<const Texture*>, unsigned int>::iterator i = textureSetIds.find(textures);
+  if (i == textureSetIds.end())
+    i = textureSetIds.insert(make_pair(textures, (unsigned int)textureSetIds.size())).first;
+
+  textureSetId_ = i->second;
+  textureSetChangeCount_ = uniforms_.changeCount_;
+  return textureSetId_;
+}
+
 static const char * getGlConstantName(GLenum c) {
   struct ValueNamePair {
     GLenum value;
@@ -186,7 +532,35 @@ static const char * getGlConstantName(GLenum c) {
   return "Unkonwn";
 }
 
-void Material::draw(Geometry& geometry, const Uniforms& extraUniforms) {
+// Where each uniform of a program gets its value from, for one pair of
+// material and extra Uniforms layouts. Built and validated once, then replayed
+// on every draw with matching layouts.
+struct UniformBindingPlan {
+  struct Binding {
+    int source;          // 0 for the material uniforms, 1 for the extra uniforms
+    int index;           // position of the value in the source Uniforms
+    GLint location;
+    GLsizei count;
+    int firstTexUnit;    // -1 if not a sampler
+  };
+
+  uint64_t materialLayout, extraLayout;
+  vector<Binding> bindings;
+  vector<GLint> texUnits; // 0, 1, ..., number of texture units used - 1
+};
+
+// Keep plans for this many extra Uniforms layouts per material
+static const size_t MAX_UNIFORM_PLANS = 4;
+
+const UniformBindingPlan& Material::getUniformPlan(const Uniforms& extraUniforms) {
+  const uint64_t materialLayout = uniforms_.getLayoutHash();
+  const uint64_t extraLayout = extraUniforms.getLayoutHash();
+
+  for (size_t i = uniformPlans_.size(); i-- > 0;) {
+    if (uniformPlans_[i]->materialLayout == materialLayout && uniformPlans_[i]->extraLayout == extraLayout)
+      return *uniformPlans_[i];
+  }
+
   static GLint maxTextureImageUnits = 0;
 
   // Initialize maxTextureImageUnits if this is called for the first time
@@ -195,12 +569,10 @@ void Material::draw(Geometry& geometry, const Uniforms& extraUniforms) {
     assert(maxTextureImageUnits > 0); // GL spec says this has to be at least 2
   }
 
-  glUseProgram(programDesc_->program);
-
-  renderStates_.apply();  // transit to current states
+  shared_ptr<UniformBindingPlan> plan(new UniformBindingPlan());
+  plan->materialLayout = materialLayout;
+  plan->extraLayout = extraLayout;
 
-  // Step 1:
-  // set the uniforms and bind the textures
   int textureUnit = 0;
   for (int i = 0, n = programDesc_->uniforms.size(); i < n; ++i) {
     const GlProgramDesc::UniformDesc& ud = programDesc_->uniforms[i];
@@ -208,45 +580,32 @@ void Material::draw(Geometry& geometry, const Uniforms& extraUniforms) {
     const Uniforms* uniformsList[] = {&uniforms_, &extraUniforms};
     int j = 0;
     for (; j < 2; ++j) {
-      const Uniforms::Value* u = uniformsList[j]->get(ud.name);
+      const Uniforms::Value* u = uniformsList[j]->get(ud.id);
 
       // if the name looks like blah[0], and the uniform is not found, we also try stripping the '[0]'
-      if (u == NULL && ud.name.length() >= 3 && ud.name.compare(ud.name.length() - 3, 3, "[0]") == 0)
-        u = uniformsList[j]->get(ud.name.substr(0, ud.name.length() - 3));
+      if (u == NULL && ud.arrayId >= 0)
+        u = uniformsList[j]->get(ud.arrayId);
 
       if (u) {
         if (u->type == ud.type && u->size >= ud.size) {
-          switch (u->type) {
-          case GL_SAMPLER_1D:
-          case GL_SAMPLER_2D:
-          case GL_SAMPLER_CUBE:
-          case GL_SAMPLER_1D_SHADOW:
-          case GL_SAMPLER_2D_SHADOW:
-          {
-            const shared_ptr<Texture> *tex = u->getTextures();
-
-            // If this assert hits, the Uniform::Value is incorrectly implemented
-            assert(tex != NULL);
-            static const int MAX_TEX_UNITS = 1024;
-            GLint texUnits[MAX_TEX_UNITS];
-            int count = 0;
-            for (; count < ud.size; ++count) {
-              if (textureUnit == maxTextureImageUnits) {
-                stringstream s;
-                s << "System allows a maximum of " << maxTextureImageUnits << ". The current shader is trying to use more than that.";
-                throw runtime_error(s.str());
-              }
-
-              glActiveTexture(GL_TEXTURE0 + textureUnit);
-              tex[count]->bind();
-              texUnits[count] = textureUnit++;
+          UniformBindingPlan::Binding b;
+          b.source = j;
+          b.index = u - uniformsList[j]->values_.begin();
+          b.location = ud.location;
+          b.count = ud.size;
+          b.firstTexUnit = -1;
+
+          if (_helper::isSamplerType(u->type)) {
+            if (textureUnit + ud.size > maxTextureImageUnits) {
+              stringstream s;
+              s << "System allows a maximum of " << maxTextureImageUnits << ". The current shader is trying to use more than that.";
+              throw runtime_error(s.str());
             }
-            u->apply(ud.location, ud.size, texUnits);
-          }
-          break;
-          default:
-            u->apply(ud.location, ud.size, NULL);
+            b.firstTexUnit = textureUnit;
+            for (int k = 0; k < ud.size; ++k)
+              plan->texUnits.push_back(textureUnit++);
           }
+          plan->bindings.push_back(b);
         }
         else {
           stringstream s;
@@ -265,55 +624,93 @@ void Material::draw(Geometry& geometry, const Uniforms& extraUniforms) {
     }
   }
 
-  // Step 2:
-  // see what attribs are provided by the geometry
-  const vector<string>& geoAttribNames = geometry.getVertexAttribNames();
+  if (uniformPlans_.size() == MAX_UNIFORM_PLANS)
+    uniformPlans_.erase(uniformPlans_.begin());
+  uniformPlans_.push_back(plan);
+  return *plan;
+}
 
-  const static int MAX_ATTRIB = 64;
-  int attribIndices[MAX_ATTRIB];
-  const size_t numAttribs = geoAttribNames.size();
+void Material::draw(Geometry& geometry, const Uniforms& extraUniforms) {
+  GlStateCache& gl = GlStateCache::getSingleton();
 
-  if (numAttribs > MAX_ATTRIB) {
-    throw runtime_error(string("Number of attributes contained in geometry is greater than maximally supported number of attributes. Consider increasing MAX_ATTRIB."));
-  }
+  // Links only finish in pollPrograms(), before the frame binds the blocks
+  // that the program may declare
+  if (programDesc_->pendingLink)
+    return;
+  gl.useProgram(programDesc_->program);
 
-  for (size_t i = 0; i < numAttribs; ++i) {
-    attribIndices[i] = -1;
-  }
+  renderStates_.apply();  // transit to current states
 
-  // simple and stupid O(n^2) wiring, should use a hashtable to reduce to O(n)
-  for (int i = 0, n = programDesc_->attribs.size(); i < n; ++i) {
-    const GlProgramDesc::AttribDesc& ad = programDesc_->attribs[i];
+  // Step 0:
+  // re-upload the material block if the material uniforms changed since, and bind it
+  if (programDesc_->materialBlock) {
+    if (!materialBlock_) {
+      materialBlock_.reset(new UniformBlock(MATERIAL_BLOCK_NAME));
+      materialBlockChangeCount_ = uniforms_.changeCount_ - 1;
+    }
+    if (materialBlockChangeCount_ != uniforms_.changeCount_) {
+      materialBlock_->update(*programDesc_->materialBlock, uniforms_);
+      materialBlockChangeCount_ = uniforms_.changeCount_;
+    }
+    materialBlock_->bind();
+  }
 
-    size_t j = 0;
-    for (; j < numAttribs; ++j) {
-      if (geoAttribNames[j] == ad.name) {
-        attribIndices[j] = ad.location;
-        break;
-      }
+  // Step 1:
+  // set the uniforms and bind the textures, as resolved by the plan
+  const UniformBindingPlan& plan = getUniformPlan(extraUniforms);
+  const Uniforms* uniformsList[] = {&uniforms_, &extraUniforms};
+  for (size_t i = 0, n = plan.bindings.size(); i < n; ++i) {
+    const UniformBindingPlan::Binding& b = plan.bindings[i];
+    const Uniforms& src = *uniformsList[b.source];
+    const Uniforms::Value& u = src.values_[b.index];
+
+    if (b.firstTexUnit < 0) {
+      src.apply(u, b.location, b.count, NULL);
     }
-    if (j == numAttribs) {
-      throw runtime_error(string("Vertex attribute ") + ad.name
-                          + ": used in the shader codes, but not supplied.");
+    else {
+      const shared_ptr<Texture> *tex = src.getTextures(u);
+      for (int k = 0; k < b.count; ++k) {
+        gl.activeTexture(b.firstTexUnit + k);
+        tex[k]->bind();
+      }
+      src.apply(u, b.location, b.count, &plan.texUnits[b.firstTexUnit]);
     }
   }
 
-  // enable the VAO associated with GL program desc
-  glBindVertexArray(programDesc_->vao);
+  // Step 2:
+  // bind the vertex array object wiring the geometry to this program, creating
+  // it on the first draw of the geometry with the program
+  GLuint vao = geometry.getVertexArray(programDesc_->program);
+  if (vao == 0)
+    vao = createVertexArray(geometry);
 
-  for (size_t i = 0; i < numAttribs; ++i) {
-    if (attribIndices[i] >= 0)
-      glEnableVertexAttribArray(attribIndices[i]);
-  }
+  gl.bindVertexArray(vao);
 
   // Now let the geometry draw its self
-  geometry.draw(attribIndices);
+  geometry.drawPrimitives();
+}
+
+GLuint Material::createVertexArray(Geometry& geometry) {
+  // see what attribs are provided by the geometry
+  const vector<string>& geoAttribNames = geometry.getVertexAttribNames();
+  const size_t numAttribs = geoAttribNames.size();
 
+  map<string, int> geoAttribIndices;
   for (size_t i = 0; i < numAttribs; ++i) {
-    if (attribIndices[i] >= 0)
-      glDisableVertexAttribArray(attribIndices[i]);
+    geoAttribIndices[geoAttribNames[i]] = i;
+  }
+
+  vector<int> attribIndices(numAttribs, -1);
+  for (int i = 0, n = programDesc_->attribs.size(); i < n; ++i) {
+    const GlProgramDesc::AttribDesc& ad = programDesc_->attribs[i];
+
+    map<string, int>::const_iterator j = geoAttribIndices.find(ad.name);
+    if (j == geoAttribIndices.end()) {
+      throw runtime_error(string("Vertex attribute ") + ad.name
+                          + ": used in the shader codes, but not supplied.");
+    }
+    attribIndices[j->second] = ad.location;
   }
 
-  // set back to default vao
-  glBindVertexArray(0);
+  return geometry.createVertexArray(programDesc_->program, numAttribs ? &attribIndices[0] : NULL);
 }
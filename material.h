@@ -11,11 +11,19 @@
 #include "geometry.h"
 
 struct GlProgramDesc;
+struct UniformBindingPlan;
+class UniformBlock;
 
 class Material {
 public:
   Material(const std::string& vsFilename, const std::string& fsFilename);
 
+  // Copies get their own material uniform block
+  Material(const Material& m);
+  Material& operator= (const Material& m);
+
+  // Skips the draw until pollPrograms() or finishPrograms() finished the
+  // program
   void draw(Geometry& geometry, const Uniforms& extraUniforms);
 
   Uniforms& getUniforms() { return uniforms_; }
@@ -24,6 +32,27 @@ public:
   RenderStates& getRenderStates() { return renderStates_; }
   const RenderStates& getRenderStates() const { return renderStates_; }
 
+  // Small integers identifying the GL program, and the set of textures bound by
+  // the material uniforms. Used to sort draws so that materials sharing them
+  // are drawn together.
+  unsigned int getProgramSortId() const;
+  unsigned int getTextureSetId();
+
+
+  // Programs are compiled and linked in the background of the driver when it
+  // can, and their draws are skipped until they are finished, by this or by
+  // pollPrograms(). This finishes all of the programs of the materials created
+  // so far, waiting for the driver and throwing the errors of their shaders, if any.
+  // Creating all materials first, then calling this, lets the driver work on
+  // them in parallel.
+  static void finishPrograms();
+
+  // Same as finishPrograms(), but only for the programs the driver is done
+  // with. Returns the number of programs still linking, whose draws are
+  // skipped meanwhile, e.g., to keep redrawing until it drops to 0. To be
+  // called before each frame, as a program finished here may declare blocks,
+  // like the per-frame one, that the frame then has to bind.
+  static int pollPrograms();
 
   /* These allow you to provide GLSL sources inline. */
   static void addInlineSource(const std::string& filename, int len, const char *content);
@@ -32,7 +61,24 @@ public:
 protected:
   std::shared_ptr<GlProgramDesc> programDesc_;
 
+  // Plans resolving the program uniforms against the layouts of uniforms_ and
+  // of the extra uniforms recently passed to draw, most recently built last
+  std::vector<std::shared_ptr<const UniformBindingPlan> > uniformPlans_;
+
+  const UniformBindingPlan& getUniformPlan(const Uniforms& extraUniforms);
+
+  // Matches the program attributes to the geometry's by name and creates the
+  // geometry's vertex array object for the program
+  GLuint createVertexArray(Geometry& geometry);
+
   Uniforms uniforms_;
 
+  // The program's MaterialBlock, filled from uniforms_ whenever they changed
+  std::shared_ptr<UniformBlock> materialBlock_;
+  unsigned int materialBlockChangeCount_;
+
+  // Cached result of getTextureSetId, valid while uniforms_.changeCount_ is unchanged
+  unsigned int textureSetId_, textureSetChangeCount_;
+
   RenderStates renderStates_;
 };
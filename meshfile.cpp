@@ -0,0 +1,154 @@
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "meshfile.h"
+#include "mappedfile.h"
+#include "pickmesh.h"
+
+using namespace std;
+
+static uint64_t alignUp(uint64_t offset) {
+  return (offset + MESH_FILE_ALIGNMENT - 1) / MESH_FILE_ALIGNMENT * MESH_FILE_ALIGNMENT;
+}
+
+static bool isIndexFormat(GLenum format) {
+  return format == GL_UNSIGNED_BYTE || format == GL_UNSIGNED_SHORT || format == GL_UNSIGNED_INT;
+}
+
+MeshFileGeometry::MeshFileGeometry(const char *filename) {
+  MappedFile file(filename);
+  const string errorPrefix = string("Mesh file ") + filename + ": ";
+
+  MeshFileHeader h;
+  if (file.size() < sizeof(h))
+    throw runtime_error(errorPrefix + "truncated header.");
+  memcpy(&h, file.data(), sizeof(h));
+  if (memcmp(h.magic, "KMSH", 4) != 0)
+    throw runtime_error(errorPrefix + "not a mesh file.");
+  if (h.version != MESH_FILE_VERSION)
+    throw runtime_error(errorPrefix + "unsupported version.");
+  if (h.numIndices > 0 && !isIndexFormat(h.indexFormat))
+    throw runtime_error(errorPrefix + "invalid index format.");
+
+  // Check that all parts lie within the file, in 64 bits so that nothing overflows
+  const uint64_t attribsEnd = sizeof(h) + uint64_t(h.numAttribs) * sizeof(MeshFileAttrib);
+  const uint64_t vertexBytes = uint64_t(h.numVertices) * h.vertexSize;
+  const uint64_t indexBytes = h.numIndices > 0 ? uint64_t(h.numIndices) * FormattedIbo::getIndexSize(h.indexFormat) : 0;
+  if (attribsEnd > file.size() ||
+      h.vertexOffset < attribsEnd || h.vertexOffset + vertexBytes > file.size() ||
+      (indexBytes > 0 && (h.indexOffset < h.vertexOffset + vertexBytes || h.indexOffset + indexBytes > file.size())))
+    throw runtime_error(errorPrefix + "truncated or overlapping data.");
+  if (h.numVertices > 0x7fffffff || h.numIndices > 0x7fffffff || h.vertexSize > 0x7fffffff)
+    throw runtime_error(errorPrefix + "too many vertices or indices.");
+
+  format_.reset(new VertexFormat(h.vertexSize));
+  for (uint32_t i = 0; i < h.numAttribs; ++i) {
+    MeshFileAttrib a;
+    memcpy(&a, file.data() + sizeof(h) + i * sizeof(a), sizeof(a));
+    a.name[sizeof(a.name) - 1] = 0;
+    if (a.name[0] == 0 || a.size <= 0 || a.size > 4 || a.offset < 0 || uint32_t(a.offset) >= h.vertexSize)
+      throw runtime_error(errorPrefix + "invalid vertex attribute.");
+    format_->put(a.name, a.size, a.type, a.normalized ? GL_TRUE : GL_FALSE, a.offset);
+  }
+
+  // The blobs go straight from the mapped pages to GL
+  file.willNeed();
+  const char *vertexData = file.data() + h.vertexOffset;
+
+  // Bounds of the positions, and the triangles for picking, read from the
+  // pages about to be uploaded anyway
+  const int position = format_->getAttribIndexForName("aPosition");
+  if (position >= 0) {
+    const VertexFormat::AttribDesc& ad = format_->getAttrib(position);
+    if (ad.type == GL_FLOAT && ad.size >= 3 && ad.offset + 3 * sizeof(float) <= h.vertexSize) {
+      Aabb bounds;
+      vector<glm::vec3> positions(h.numVertices);
+      for (uint32_t i = 0; i < h.numVertices; ++i) {
+        memcpy(&positions[i], vertexData + size_t(i) * h.vertexSize + ad.offset, 3 * sizeof(float));
+        bounds.extend(positions[i]);
+      }
+      setBounds(bounds);
+
+      if (h.primitiveType == GL_TRIANGLES) {
+        vector<unsigned int> indices(h.numIndices > 0 ? h.numIndices : h.numVertices);
+        const char *indexData = file.data() + h.indexOffset;
+        for (size_t i = 0; i < indices.size(); ++i) {
+          if (h.numIndices == 0)
+            indices[i] = i;
+          else if (h.indexFormat == GL_UNSIGNED_BYTE)
+            indices[i] = reinterpret_cast<const unsigned char *>(indexData)[i];
+          else if (h.indexFormat == GL_UNSIGNED_SHORT)
+            indices[i] = reinterpret_cast<const unsigned short *>(indexData)[i];
+          else
+            indices[i] = reinterpret_cast<const unsigned int *>(indexData)[i];
+          if (indices[i] >= h.numVertices)
+            throw runtime_error(errorPrefix + "index out of range.");
+        }
+        setPickMesh(make_shared<PickMesh>(positions, indices));
+      }
+    }
+  }
+
+  vbo_.reset(new FormattedVbo(shared_ptr<const VertexFormat>(format_)));
+  vbo_->uploadRaw(vertexData, h.numVertices);
+  wire(vbo_);
+
+  if (h.numIndices > 0) {
+    ibo_.reset(new FormattedIbo(h.indexFormat));
+    ibo_->uploadRaw(file.data() + h.indexOffset, h.numIndices);
+    indexedBy(ibo_);
+  }
+  primitiveType(h.primitiveType);
+}
+
+void MeshFileGeometry::write(const char *filename, const VertexFormat& format, const void *vertices, int numVertices,
+                             GLenum indexFormat, const void *indices, int numIndices, GLenum primitiveType) {
+  if (numIndices > 0 && !isIndexFormat(indexFormat))
+    throw runtime_error(string("Mesh file ") + filename + ": invalid index format.");
+
+  MeshFileHeader h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, "KMSH", 4);
+  h.version = MESH_FILE_VERSION;
+  h.primitiveType = primitiveType;
+  h.vertexSize = format.getVertexSize();
+  h.numAttribs = format.getNumAttribs();
+  h.numVertices = numVertices;
+  h.indexFormat = numIndices > 0 ? indexFormat : 0;
+  h.numIndices = numIndices;
+
+  const uint64_t vertexBytes = uint64_t(numVertices) * h.vertexSize;
+  const uint64_t indexBytes = numIndices > 0 ? uint64_t(numIndices) * FormattedIbo::getIndexSize(indexFormat) : 0;
+  h.vertexOffset = alignUp(sizeof(h) + h.numAttribs * sizeof(MeshFileAttrib));
+  h.indexOffset = alignUp(h.vertexOffset + vertexBytes);
+
+  vector<MeshFileAttrib> attribs(h.numAttribs);
+  for (int i = 0; i < format.getNumAttribs(); ++i) {
+    const VertexFormat::AttribDesc& ad = format.getAttrib(i);
+    if (ad.name.size() >= sizeof(attribs[i].name))
+      throw runtime_error(string("Mesh file ") + filename + ": attribute name " + ad.name + " is too long.");
+    memset(&attribs[i], 0, sizeof(MeshFileAttrib));
+    strcpy(attribs[i].name, ad.name.c_str());
+    attribs[i].size = ad.size;
+    attribs[i].type = ad.type;
+    attribs[i].normalized = ad.normalized;
+    attribs[i].offset = ad.offset;
+  }
+
+  ofstream f(filename, ios::binary);
+  const char padding[MESH_FILE_ALIGNMENT] = {0};
+  f.write(reinterpret_cast<const char *>(&h), sizeof(h));
+  if (!attribs.empty())
+    f.write(reinterpret_cast<const char *>(&attribs[0]), attribs.size() * sizeof(MeshFileAttrib));
+  f.write(padding, h.vertexOffset - (sizeof(h) + attribs.size() * sizeof(MeshFileAttrib)));
+  f.write(static_cast<const char *>(vertices), vertexBytes);
+  if (indexBytes > 0) {
+    f.write(padding, h.indexOffset - (h.vertexOffset + vertexBytes));
+    f.write(static_cast<const char *>(indices), indexBytes);
+  }
+  if (!f)
+    throw runtime_error(string("Mesh file ") + filename + ": cannot write.");
+}
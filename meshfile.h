@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+
+#include "geometry.h"
+
+// Binary mesh container, loaded by mapping the file and uploading the vertex
+// and index blobs straight from the mapped pages, without intermediate copies.
+//
+// Layout, all integers little endian:
+//
+//   MeshFileHeader
+//   MeshFileAttrib[numAttribs]     describing the VertexFormat
+//   vertex blob                    numVertices * vertexSize bytes, at vertexOffset
+//   index blob                     numIndices * index size bytes, at indexOffset
+//
+// Both blobs start at multiples of MESH_FILE_ALIGNMENT.
+
+static const int MESH_FILE_ALIGNMENT = 16;
+
+struct MeshFileHeader {
+  char magic[4];           // "KMSH"
+  uint32_t version;        // MESH_FILE_VERSION
+  uint32_t primitiveType;  // GL_TRIANGLES, ...
+  uint32_t vertexSize;     // in bytes
+  uint32_t numAttribs;
+  uint32_t numVertices;
+  uint32_t indexFormat;    // GL_UNSIGNED_BYTE, GL_UNSIGNED_SHORT, GL_UNSIGNED_INT, or 0 if not indexed
+  uint32_t numIndices;
+  uint64_t vertexOffset, indexOffset;
+};
+
+struct MeshFileAttrib {
+  char name[32];           // zero terminated
+  int32_t size;
+  uint32_t type;
+  uint32_t normalized;
+  int32_t offset;
+};
+
+static const uint32_t MESH_FILE_VERSION = 1;
+
+// Geometry read from a binary mesh file. Owns the VertexFormat described in
+// the file. Throws runtime_error if the file is missing or malformed.
+class MeshFileGeometry : public BufferObjectGeometry {
+public:
+  explicit MeshFileGeometry(const char *filename);
+
+  int getNumVertices() const {
+    return vbo_->length();
+  }
+
+  int getNumIndices() const {
+    return ibo_ ? ibo_->length() : 0;
+  }
+
+  // Writes vertices of the given format, and optionally indices, as a mesh file
+  static void write(const char *filename, const VertexFormat& format, const void *vertices, int numVertices,
+                    GLenum indexFormat, const void *indices, int numIndices, GLenum primitiveType = GL_TRIANGLES);
+
+  // Shortcut for vertex types with a static FORMAT, such as VertexPNTBX
+  template<typename Vertex, typename Index>
+  static void write(const char *filename, const Vertex *vertices, int numVertices, const Index *indices, int numIndices) {
+    write(filename, Vertex::FORMAT, vertices, numVertices,
+          sizeof(Index) == 1 ? GL_UNSIGNED_BYTE : sizeof(Index) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+          indices, numIndices);
+  }
+
+private:
+  // Shared with vbo_, which may outlive this geometry in vertex arrays
+  std::shared_ptr<VertexFormat> format_;
+  std::shared_ptr<FormattedVbo> vbo_;
+  std::shared_ptr<FormattedIbo> ibo_;
+};
@@ -0,0 +1,193 @@
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <unordered_map>
+
+#include "meshoptimizer.h"
+
+using namespace std;
+
+float computeAcmr(const unsigned int *indices, int numIndices, int numVertices, int cacheSize) {
+  if (numIndices < 3)
+    return 0;
+
+  // A vertex is in the FIFO cache if it was inserted less than cacheSize misses ago
+  vector<int> insertedAt(numVertices, -cacheSize - 1);
+  int misses = 0;
+  for (int i = 0; i < numIndices; ++i) {
+    const unsigned int v = indices[i];
+    assert((int)v < numVertices);
+    if (misses - insertedAt[v] > cacheSize)
+      insertedAt[v] = misses++;
+  }
+  return float(misses) / (numIndices / 3);
+}
+
+namespace {
+
+// Working state of Tipsify. Vertex-to-triangle adjacency is stored CSR style:
+// the triangles using vertex v are adjacency[offsets[v] .. offsets[v+1]).
+struct Tipsify {
+  const unsigned int *indices;
+  int numVertices, cacheSize;
+
+  vector<int> offsets, adjacency;
+  vector<int> liveTriangles;  // per vertex, triangles not emitted yet
+  vector<int> cacheTime;      // per vertex, time stamp of entering the cache
+  vector<bool> emitted;       // per triangle
+  vector<int> deadEnd;        // stack of recently used vertices
+  int time, nextCandidate;
+
+  Tipsify(const unsigned int *indices, int numIndices, int numVertices, int cacheSize)
+    : indices(indices), numVertices(numVertices), cacheSize(cacheSize),
+      offsets(numVertices + 1, 0), adjacency(numIndices), liveTriangles(numVertices, 0),
+      cacheTime(numVertices, 0), emitted(numIndices / 3, false), time(cacheSize + 1), nextCandidate(0) {
+    for (int i = 0; i < numIndices; ++i)
+      ++liveTriangles[indices[i]];
+    for (int v = 0; v < numVertices; ++v)
+      offsets[v + 1] = offsets[v] + liveTriangles[v];
+
+    vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for (int i = 0; i < numIndices; ++i)
+      adjacency[fill[indices[i]]++] = i / 3;
+  }
+
+  // The next vertex to fan around: the candidate that will still be in the
+  // cache after emitting all its triangles and that entered the cache the
+  // earliest, or a dead-end vertex, or any vertex with triangles left
+  int getNextVertex(const vector<int>& candidates) {
+    int best = -1, bestPriority = 0;
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      const int v = candidates[i];
+      if (liveTriangles[v] > 0) {
+        int priority = 0;
+        if (time - cacheTime[v] + 2 * liveTriangles[v] <= cacheSize)
+          priority = time - cacheTime[v];
+        if (priority > bestPriority) {
+          bestPriority = priority;
+          best = v;
+        }
+      }
+    }
+    return best >= 0 ? best : skipDeadEnd();
+  }
+
+  int skipDeadEnd() {
+    while (!deadEnd.empty()) {
+      const int v = deadEnd.back();
+      deadEnd.pop_back();
+      if (liveTriangles[v] > 0)
+        return v;
+    }
+    for (; nextCandidate < numVertices; ++nextCandidate) {
+      if (liveTriangles[nextCandidate] > 0)
+        return nextCandidate;
+    }
+    return -1;
+  }
+
+  void run(vector<unsigned int>& output) {
+    vector<int> candidates;
+    int fan = skipDeadEnd();
+    while (fan >= 0) {
+      candidates.clear();
+      for (int a = offsets[fan]; a < offsets[fan + 1]; ++a) {
+        const int t = adjacency[a];
+        if (emitted[t])
+          continue;
+        emitted[t] = true;
+        for (int k = 0; k < 3; ++k) {
+          const int v = indices[3 * t + k];
+          output.push_back(v);
+          deadEnd.push_back(v);
+          candidates.push_back(v);
+          --liveTriangles[v];
+          if (time - cacheTime[v] > cacheSize)
+            cacheTime[v] = time++;
+        }
+      }
+      fan = getNextVertex(candidates);
+    }
+  }
+};
+
+} // namespace
+
+void optimizeVertexCache(unsigned int *indices, int numIndices, int numVertices, int cacheSize) {
+  assert(numIndices % 3 == 0);
+  if (numIndices == 0)
+    return;
+
+  vector<unsigned int> output;
+  output.reserve(numIndices);
+  Tipsify(indices, numIndices, numVertices, cacheSize).run(output);
+
+  assert((int)output.size() == numIndices);
+  copy(output.begin(), output.end(), indices);
+}
+
+int optimizeVertexFetch(unsigned int *indices, int numIndices, int numVertices, vector<int>& remap) {
+  remap.assign(numVertices, -1);
+  int numUsed = 0;
+  for (int i = 0; i < numIndices; ++i) {
+    int& r = remap[indices[i]];
+    if (r < 0)
+      r = numUsed++;
+    indices[i] = r;
+  }
+  return numUsed;
+}
+
+void clusterVertices(const vector<glm::vec3>& positions, const unsigned int *indices, int numIndices,
+                     int gridSize, vector<unsigned int>& outIndices) {
+  outIndices.clear();
+  if (positions.empty())
+    return;
+
+  glm::vec3 lo(FLT_MAX), hi(-FLT_MAX);
+  for (size_t i = 0; i < positions.size(); ++i) {
+    lo = glm::min(lo, positions[i]);
+    hi = glm::max(hi, positions[i]);
+  }
+  const glm::vec3 cellsPerUnit = float(gridSize) / glm::max(hi - lo, glm::vec3(1e-20f));
+
+  // Cell of each vertex, and the sum of the positions in each cell
+  vector<int> cellOf(positions.size());
+  unordered_map<long long, int> cellIds;
+  vector<glm::vec3> sums;
+  vector<int> counts;
+  for (size_t i = 0; i < positions.size(); ++i) {
+    const glm::ivec3 c = glm::min(glm::ivec3((positions[i] - lo) * cellsPerUnit), glm::ivec3(gridSize - 1));
+    const long long key = ((long long)c.x * gridSize + c.y) * gridSize + c.z;
+    const pair<unordered_map<long long, int>::iterator, bool> inserted = cellIds.insert(make_pair(key, (int)sums.size()));
+    if (inserted.second) {
+      sums.push_back(glm::vec3(0));
+      counts.push_back(0);
+    }
+    cellOf[i] = inserted.first->second;
+    sums[cellOf[i]] += positions[i];
+    ++counts[cellOf[i]];
+  }
+
+  // The representative of each cell is its vertex closest to the mean
+  vector<int> representative(sums.size(), -1);
+  vector<float> bestDistance(sums.size(), FLT_MAX);
+  for (size_t i = 0; i < positions.size(); ++i) {
+    const int c = cellOf[i];
+    const glm::vec3 d = positions[i] - sums[c] / float(counts[c]);
+    const float distance = glm::dot(d, d);
+    if (distance < bestDistance[c]) {
+      bestDistance[c] = distance;
+      representative[c] = i;
+    }
+  }
+
+  for (int i = 0; i + 2 < numIndices; i += 3) {
+    const int a = cellOf[indices[i]], b = cellOf[indices[i + 1]], c = cellOf[indices[i + 2]];
+    if (a == b || b == c || c == a)
+      continue;
+    outIndices.push_back(representative[a]);
+    outIndices.push_back(representative[b]);
+    outIndices.push_back(representative[c]);
+  }
+}
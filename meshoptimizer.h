@@ -0,0 +1,101 @@
+#pragma once
+
+#include <vector>
+
+#include <glm/glm.hpp>
+
+// Mesh processing run between the make* functions of geometrymaker.h and the
+// upload of indexed triangle lists:
+//
+// - optimizeVertexCache reorders the triangles for the post-transform vertex
+//   cache (Tipsify, Sander et al. 2007)
+// - optimizeVertexFetch renumbers the vertices in order of first use, so that
+//   vertex fetches walk the vertex buffer mostly sequentially
+// - simplifyMesh makes coarser levels of detail by vertex clustering
+//
+// Both work on 32-bit indices; the narrowest index format that fits is picked
+// at upload time, see FormattedIbo::chooseFormat and IndexedGeometry. E.g.,
+//
+//   vector<VertexPNTBX> vtx(vbLen);
+//   vector<unsigned int> idx(ibLen);
+//   makeSphere(1, 20, 10, vtx.begin(), idx.begin());
+//   MeshOptimizerStats stats = optimizeMesh(vtx, idx);
+//   geometry.reset(new IndexedGeometryPNTBX(&vtx[0], &idx[0], vtx.size(), idx.size()));
+
+// Cache size assumed by default. Tipsify is not very sensitive to the exact
+// size, and most GPUs have caches of at least that many entries.
+static const int kDefaultVertexCacheSize = 16;
+
+struct MeshOptimizerStats {
+  // Average cache miss ratio, i.e., vertices transformed per triangle, of a
+  // simulated FIFO cache: 3 is the worst, 0.5 the best on large regular meshes
+  float acmrBefore, acmrAfter;
+  int numVerticesBefore, numVerticesAfter;
+};
+
+// ACMR of the triangle list `indices' on a FIFO cache of `cacheSize' entries
+float computeAcmr(const unsigned int *indices, int numIndices, int numVertices,
+                  int cacheSize = kDefaultVertexCacheSize);
+
+// Reorders the triangles of the list `indices' in place
+void optimizeVertexCache(unsigned int *indices, int numIndices, int numVertices,
+                         int cacheSize = kDefaultVertexCacheSize);
+
+// Renumbers the vertices referenced by `indices' in order of first use, and
+// rewrites the indices. On return, remap[v] is the new position of old vertex
+// v, or -1 if no triangle uses it. Returns the number of vertices in use.
+int optimizeVertexFetch(unsigned int *indices, int numIndices, int numVertices, std::vector<int>& remap);
+
+// Runs both optimizations on a triangle list and its vertices. Unused
+// vertices are dropped.
+template<typename Vertex>
+MeshOptimizerStats optimizeMesh(std::vector<Vertex>& vertices, std::vector<unsigned int>& indices,
+                                int cacheSize = kDefaultVertexCacheSize) {
+  MeshOptimizerStats stats;
+  stats.numVerticesBefore = vertices.size();
+  stats.acmrBefore = computeAcmr(&indices[0], indices.size(), vertices.size(), cacheSize);
+
+  optimizeVertexCache(&indices[0], indices.size(), vertices.size(), cacheSize);
+
+  std::vector<int> remap;
+  const int numUsed = optimizeVertexFetch(&indices[0], indices.size(), vertices.size(), remap);
+  std::vector<int> order(numUsed);
+  for (size_t v = 0; v < vertices.size(); ++v) {
+    if (remap[v] >= 0)
+      order[remap[v]] = v;
+  }
+  std::vector<Vertex> reordered;
+  reordered.reserve(numUsed);
+  for (int i = 0; i < numUsed; ++i)
+    reordered.push_back(vertices[order[i]]);
+  vertices.swap(reordered);
+
+  stats.numVerticesAfter = numUsed;
+  stats.acmrAfter = computeAcmr(&indices[0], indices.size(), numUsed, cacheSize);
+  return stats;
+}
+
+// Simplifies the triangle list `indices' by vertex clustering: the bounds of
+// the positions are divided into gridSize^3 cells, all vertices of a cell are
+// replaced by the one closest to the mean of the cell, and triangles that
+// collapse are dropped. Writes the simplified list, still indexing the
+// original vertices, to `outIndices'.
+void clusterVertices(const std::vector<glm::vec3>& positions, const unsigned int *indices, int numIndices,
+                     int gridSize, std::vector<unsigned int>& outIndices);
+
+// A simplified copy of a mesh for a coarser level of detail, see
+// clusterVertices, optimized like optimizeMesh does
+template<typename Vertex>
+void simplifyMesh(const std::vector<Vertex>& vertices, const std::vector<unsigned int>& indices, int gridSize,
+                  std::vector<Vertex>& outVertices, std::vector<unsigned int>& outIndices) {
+  std::vector<glm::vec3> positions(vertices.size());
+  for (size_t i = 0; i < vertices.size(); ++i)
+    positions[i] = vertices[i].p;
+  clusterVertices(positions, &indices[0], indices.size(), gridSize, outIndices);
+
+  outVertices = vertices;
+  if (!outIndices.empty())
+    optimizeMesh(outVertices, outIndices);
+  else
+    outVertices.clear();
+}
@@ -0,0 +1,264 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+#include "ppm.h"
+#include "hash.h"
+#include "mappedfile.h"
+#include "mipcache.h"
+
+using namespace std;
+
+// Layout of a cache file: this header, then the levels from the largest to
+// the smallest, each stored as tightly packed bottom-up RGBA8 rows.
+struct MipCacheHeader {
+  char magic[8];
+  uint64_t sourceHash;  // fnv1aHash of the whole PPM file
+  uint64_t sourceSize;  // size of the PPM file in bytes
+  int64_t sourceTime;   // modification time of the PPM file
+  uint32_t srgb;
+  uint32_t numLevels;
+  uint32_t width, height;
+};
+
+static const char kMipCacheMagic[8] = { 'K', 'F', 'M', 'I', 'P', 'S', '2', '\n' };
+
+MipChain::MipChain() : internalFormat_(GL_RGBA8) {}
+
+MipChain::~MipChain() {}
+
+size_t MipChain::getSize() const {
+  size_t size = 0;
+  for (size_t i = 0; i < levels_.size(); ++i)
+    size += (size_t)levels_[i].width * levels_[i].height * 4;
+  return size;
+}
+
+void MipChain::copyTo(unsigned char *dst) const {
+  for (size_t i = 0; i < levels_.size(); ++i) {
+    const size_t levelSize = (size_t)levels_[i].width * levels_[i].height * 4;
+    memcpy(dst, levels_[i].data, levelSize);
+    dst += levelSize;
+  }
+}
+
+static string getCacheFileName(const char *ppmFileName, bool srgb) {
+  return string(ppmFileName) + (srgb ? ".srgb.mips" : ".mips");
+}
+
+// Number of levels in a full mip chain for the given size
+static int getNumMipLevels(int width, int height) {
+  int n = 1;
+  while (width > 1 || height > 1) {
+    width = max(width / 2, 1);
+    height = max(height / 2, 1);
+    ++n;
+  }
+  return n;
+}
+
+static size_t getMipChainSize(int width, int height, int numLevels) {
+  size_t size = 0;
+  for (int i = 0; i < numLevels; ++i) {
+    size += (size_t)width * height * 4;
+    width = max(width / 2, 1);
+    height = max(height / 2, 1);
+  }
+  return size;
+}
+
+// Points the levels of `chain' at consecutive ranges of `data'
+static void setupLevels(const unsigned char *data, int width, int height, int numLevels,
+                        vector<MipChain::Level>& levels) {
+  levels.resize(numLevels);
+  for (int i = 0; i < numLevels; ++i) {
+    levels[i].width = width;
+    levels[i].height = height;
+    levels[i].data = data;
+    data += (size_t)width * height * 4;
+    width = max(width / 2, 1);
+    height = max(height / 2, 1);
+  }
+}
+
+static float srgbToLinear(float c) {
+  return c <= 0.04045f ? c / 12.92f : pow((c + 0.055f) / 1.055f, 2.4f);
+}
+
+static unsigned char linearToSrgb(float c) {
+  c = c <= 0.0031308f ? c * 12.92f : 1.055f * pow(c, 1.0f / 2.4f) - 0.055f;
+  return (unsigned char)(min(max(c, 0.0f), 1.0f) * 255.0f + 0.5f);
+}
+
+// Halves `src' into `dst' with a 2x2 box filter. Color channels are averaged
+// in linear space when `srgb' is true. Odd sizes clamp at the last row/column.
+static void downsample(const MipChain::Level& src, unsigned char *dst, bool srgb, const float *toLinear) {
+  const int w = max(src.width / 2, 1), h = max(src.height / 2, 1);
+  for (int y = 0; y < h; ++y) {
+    const int y0 = min(2 * y, src.height - 1), y1 = min(2 * y + 1, src.height - 1);
+    for (int x = 0; x < w; ++x) {
+      const int x0 = min(2 * x, src.width - 1), x1 = min(2 * x + 1, src.width - 1);
+      const unsigned char *p[4] = {
+        src.data + ((size_t)y0 * src.width + x0) * 4,
+        src.data + ((size_t)y0 * src.width + x1) * 4,
+        src.data + ((size_t)y1 * src.width + x0) * 4,
+        src.data + ((size_t)y1 * src.width + x1) * 4,
+      };
+      unsigned char *out = dst + ((size_t)y * w + x) * 4;
+      for (int c = 0; c < 4; ++c) {
+        if (srgb && c < 3) {
+          const float sum = toLinear[p[0][c]] + toLinear[p[1][c]] + toLinear[p[2][c]] + toLinear[p[3][c]];
+          out[c] = linearToSrgb(sum * 0.25f);
+        }
+        else
+          out[c] = (unsigned char)((p[0][c] + p[1][c] + p[2][c] + p[3][c] + 2) / 4);
+      }
+    }
+  }
+}
+
+// Decodes the PPM and fills `storage' with the complete RGBA8 chain
+static void buildMipChain(const PpmImage& image, bool srgb, vector<unsigned char>& storage,
+                          vector<MipChain::Level>& levels) {
+  const int width = image.width(), height = image.height();
+  const int numLevels = getNumMipLevels(width, height);
+  storage.resize(getMipChainSize(width, height, numLevels));
+  setupLevels(&storage[0], width, height, numLevels, levels);
+
+  unsigned char *dst = &storage[0];
+  for (int row = 0; row < height; ++row) {
+    const PackedPixel *src = image.row(row);
+    for (int x = 0; x < width; ++x, dst += 4) {
+      dst[0] = src[x].r;
+      dst[1] = src[x].g;
+      dst[2] = src[x].b;
+      dst[3] = 255;
+    }
+  }
+
+  float toLinear[256];
+  for (int i = 0; i < 256; ++i)
+    toLinear[i] = srgbToLinear(i / 255.0f);
+
+  for (int i = 1; i < numLevels; ++i)
+    downsample(levels[i - 1], const_cast<unsigned char *>(levels[i].data), srgb, toLinear);
+}
+
+// Writes the cache file next to the PPM. Failures (e.g., read-only directory)
+// only cost the next launch the decode, hence are reported but not fatal.
+static void writeMipCache(const string& cacheFileName, const MipCacheHeader& header,
+                          const vector<unsigned char>& storage) {
+  const string tmpFileName = cacheFileName + ".tmp";
+  {
+    ofstream f(tmpFileName.c_str(), ios::binary);
+    f.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    f.write(reinterpret_cast<const char *>(&storage[0]), storage.size());
+    if (!f) {
+      cerr << "WARN: cannot write mipmap cache " << cacheFileName << endl;
+      f.close();
+      remove(tmpFileName.c_str());
+      return;
+    }
+  }
+  // write then rename, so that a concurrent reader never sees a partial file
+  remove(cacheFileName.c_str());
+  if (rename(tmpFileName.c_str(), cacheFileName.c_str()) != 0) {
+    cerr << "WARN: cannot write mipmap cache " << cacheFileName << endl;
+    remove(tmpFileName.c_str());
+  }
+}
+
+// Reads the header of the cache file, if the file exists and is consistent
+// with its header. Says nothing yet about whether the cache is up to date.
+static bool readMipCacheHeader(const string& cacheFileName, bool srgb, MipCacheHeader& header) {
+  ifstream f(cacheFileName.c_str(), ios::binary | ios::ate);
+  if (!f)
+    return false;  // no cache yet
+  const uint64_t size = f.tellg();
+  f.seekg(0);
+  return f.read(reinterpret_cast<char *>(&header), sizeof(header)) &&
+      !memcmp(header.magic, kMipCacheMagic, sizeof(kMipCacheMagic)) &&
+      header.srgb == (uint32_t)srgb && header.width > 0 && header.height > 0 &&
+      header.numLevels == (uint32_t)getNumMipLevels(header.width, header.height) &&
+      size == sizeof(header) + getMipChainSize(header.width, header.height, header.numLevels);
+}
+
+static uint64_t hashFile(const char *filename) {
+  MappedFile file(filename);
+  return fnv1aHash(file.data(), file.size());
+}
+
+void loadMipChain(const char *ppmFileName, bool srgb, MipChain& chain) {
+  chain.internalFormat_ = srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+  chain.levels_.clear();
+  chain.storage_.clear();
+  chain.file_.reset();
+
+  struct stat st;
+  if (stat(ppmFileName, &st) != 0)
+    throw runtime_error(string("Cannot open file ") + ppmFileName);
+  const uint64_t sourceSize = st.st_size;
+  const int64_t sourceTime = st.st_mtime;
+
+  // The PPM is only hashed when its size or modification time differ from
+  // those the cache was built from, e.g., after a checkout, since hashing
+  // costs about as much as the decode the cache saves
+  const string cacheFileName = getCacheFileName(ppmFileName, srgb);
+  MipCacheHeader header;
+  bool hashed = false;
+  uint64_t sourceHash = 0;
+  if (readMipCacheHeader(cacheFileName, srgb, header) && header.sourceSize == sourceSize) {
+    bool upToDate = header.sourceTime == sourceTime;
+    if (!upToDate) {
+      sourceHash = hashFile(ppmFileName);
+      hashed = true;
+      upToDate = header.sourceHash == sourceHash;
+      if (upToDate) {
+        // same content, so only record the new time for the next launch
+        header.sourceTime = sourceTime;
+        fstream f(cacheFileName.c_str(), ios::binary | ios::in | ios::out);
+        f.write(reinterpret_cast<const char *>(&header), sizeof(header));
+      }
+    }
+
+    if (upToDate) {
+      try {
+        unique_ptr<MappedFile> cache(new MappedFile(cacheFileName.c_str()));
+        if (cache->size() == sizeof(header) + getMipChainSize(header.width, header.height, header.numLevels)) {
+          setupLevels(reinterpret_cast<const unsigned char *>(cache->data()) + sizeof(header),
+                      header.width, header.height, header.numLevels, chain.levels_);
+          chain.file_.swap(cache);
+          return;
+        }
+      }
+      catch (const runtime_error&) {
+        // removed in the meantime
+      }
+    }
+  }
+
+  if (!hashed)
+    sourceHash = hashFile(ppmFileName);
+
+  PpmImage image(ppmFileName);
+  buildMipChain(image, srgb, chain.storage_, chain.levels_);
+
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMipCacheMagic, sizeof(kMipCacheMagic));
+  header.sourceHash = sourceHash;
+  header.sourceSize = sourceSize;
+  header.sourceTime = sourceTime;
+  header.srgb = srgb;
+  header.numLevels = chain.levels_.size();
+  header.width = image.width();
+  header.height = image.height();
+  writeMipCache(cacheFileName, header, chain.storage_);
+}
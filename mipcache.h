@@ -0,0 +1,70 @@
+#ifndef MIPCACHE_H
+#define MIPCACHE_H
+
+#include <vector>
+#include <memory>
+
+#include "glsupport.h"
+
+class MappedFile;
+
+// A full chain of RGBA8 mipmap levels of an image, level 0 being the image
+// itself, in bottom-up row order ready for glTexImage2D. Every row is a
+// multiple of 4 bytes long, so the levels upload with any GL_UNPACK_ALIGNMENT.
+class MipChain {
+public:
+  struct Level {
+    int width, height;
+    const unsigned char *data;
+  };
+
+  MipChain();
+  ~MipChain();
+
+  // GL_SRGB8_ALPHA8 or GL_RGBA8
+  GLenum getInternalFormat() const {
+    return internalFormat_;
+  }
+
+  int getNumLevels() const {
+    return (int)levels_.size();
+  }
+
+  const Level& getLevel(int i) const {
+    return levels_[i];
+  }
+
+  // Size of all levels together, in bytes
+  size_t getSize() const;
+
+  // Copies the levels to `dst', one after the other from the largest, with
+  // no padding in between. Needs getSize() bytes.
+  void copyTo(unsigned char *dst) const;
+
+  // true if the levels were read from the sidecar cache file
+  bool isFromCache() const {
+    return (bool)file_;
+  }
+
+private:
+  friend void loadMipChain(const char *ppmFileName, bool srgb, MipChain& chain);
+
+  GLenum internalFormat_;
+  std::vector<Level> levels_;
+
+  // Backing storage of the levels: either computed, or mapped from the cache file
+  std::vector<unsigned char> storage_;
+  std::unique_ptr<MappedFile> file_;
+
+  MipChain(const MipChain&);
+  const MipChain& operator=(const MipChain&);
+};
+
+// Loads the mip chain of a PPM file into `chain'. The chain is read from a sidecar
+// cache file next to the PPM if the cache was built from the same PPM content
+// (same size and modification time, or else same hash). Otherwise the PPM is decoded, the chain is built on the CPU
+// (filtering in linear space if `srgb' is true), and the cache file is rewritten.
+// Throws runtime_error if the PPM cannot be read.
+void loadMipChain(const char *ppmFileName, bool srgb, MipChain& chain);
+
+#endif
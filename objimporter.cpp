@@ -0,0 +1,355 @@
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+#include "objimporter.h"
+#include "meshoptimizer.h"
+#include "pickmesh.h"
+#include "tangentgenerator.h"
+#include "threadpool.h"
+
+using namespace std;
+
+namespace {
+
+const int MISSING = INT_MIN;
+
+// One corner of a triangle, as indices into the positions, texture
+// coordinates, and normals of the file. Negative OBJ indices count back from
+// the current element; they are stored relative to the first element of the
+// chunk, and marked in `relative', until the chunk is merged.
+struct Corner {
+  int v, t, n;
+  unsigned char relative;   // bit 0: v, bit 1: t, bit 2: n
+};
+
+// Elements parsed from a range of lines
+struct Chunk {
+  const char *begin, *end;
+  int firstLine;
+
+  vector<glm::vec3> positions, normals;
+  vector<glm::vec2> texCoords;
+  vector<Corner> corners;   // three per triangle
+  string error;
+};
+
+inline const char *skipSpaces(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t'))
+    ++p;
+  return p;
+}
+
+// Parses up to `maxCount' floats, returns the number parsed
+int parseFloats(const char *&p, const char *end, float *out, int maxCount) {
+  int count = 0;
+  while (count < maxCount) {
+    p = skipSpaces(p, end);
+    // from_chars does not accept a leading '+'
+    if (p < end && *p == '+')
+      ++p;
+    const from_chars_result r = from_chars(p, end, out[count]);
+    if (r.ec != errc())
+      break;
+    p = r.ptr;
+    ++count;
+  }
+  return count;
+}
+
+// Parses one index of a face vertex, OBJ style: 1 based, or negative to count back
+bool parseIndex(const char *&p, const char *end, int localCount, int& index, unsigned char& relative, unsigned char bit) {
+  int value;
+  const from_chars_result r = from_chars(p, end, value);
+  if (r.ec != errc() || value == 0)
+    return false;
+  p = r.ptr;
+  if (value > 0)
+    index = value - 1;
+  else {
+    index = localCount + value;
+    relative |= bit;
+  }
+  return true;
+}
+
+// Parses "v", "v/t", "v//n", or "v/t/n"
+bool parseCorner(const char *&p, const char *end, const Chunk& c, Corner& corner) {
+  corner.t = corner.n = MISSING;
+  corner.relative = 0;
+  if (!parseIndex(p, end, c.positions.size(), corner.v, corner.relative, 1))
+    return false;
+  if (p < end && *p == '/') {
+    ++p;
+    if (p < end && *p != '/' && !parseIndex(p, end, c.texCoords.size(), corner.t, corner.relative, 2))
+      return false;
+    if (p < end && *p == '/') {
+      ++p;
+      if (!parseIndex(p, end, c.normals.size(), corner.n, corner.relative, 4))
+        return false;
+    }
+  }
+  return true;
+}
+
+void parseChunk(Chunk& c) {
+  const char *p = c.begin;
+  int line = c.firstLine;
+  vector<Corner> polygon;
+
+  for (; p < c.end; ++line) {
+    const char *eol = static_cast<const char *>(memchr(p, '\n', c.end - p));
+    if (eol == NULL)
+      eol = c.end;
+    const char *q = skipSpaces(p, eol);
+
+    bool ok = true;
+    if (eol - q >= 2 && q[0] == 'v' && (q[1] == ' ' || q[1] == '\t')) {
+      float f[3];
+      q += 2;
+      ok = parseFloats(q, eol, f, 3) == 3;
+      c.positions.push_back(glm::vec3(f[0], f[1], f[2]));
+    }
+    else if (eol - q >= 3 && q[0] == 'v' && q[1] == 'n' && (q[2] == ' ' || q[2] == '\t')) {
+      float f[3];
+      q += 3;
+      ok = parseFloats(q, eol, f, 3) == 3;
+      c.normals.push_back(glm::vec3(f[0], f[1], f[2]));
+    }
+    else if (eol - q >= 3 && q[0] == 'v' && q[1] == 't' && (q[2] == ' ' || q[2] == '\t')) {
+      float f[3] = {0, 0, 0};
+      q += 3;
+      ok = parseFloats(q, eol, f, 3) >= 1;
+      c.texCoords.push_back(glm::vec2(f[0], f[1]));
+    }
+    else if (eol - q >= 2 && q[0] == 'f' && (q[1] == ' ' || q[1] == '\t')) {
+      polygon.clear();
+      q = skipSpaces(q + 2, eol);
+      while (ok && q < eol && *q != '\r') {
+        Corner corner;
+        ok = parseCorner(q, eol, c, corner);
+        polygon.push_back(corner);
+        q = skipSpaces(q, eol);
+      }
+      ok = ok && polygon.size() >= 3;
+      for (size_t i = 2; ok && i < polygon.size(); ++i) {
+        c.corners.push_back(polygon[0]);
+        c.corners.push_back(polygon[i - 1]);
+        c.corners.push_back(polygon[i]);
+      }
+    }
+
+    if (!ok) {
+      stringstream s;
+      s << "line " << line << ": cannot parse \"" << string(p, eol - p) << "\"";
+      c.error = s.str();
+      return;
+    }
+    p = eol + 1;
+  }
+}
+
+// Splits [begin, end) into up to `numChunks' ranges of whole lines
+void splitIntoChunks(const char *begin, const char *end, int numChunks, int firstLine, vector<Chunk>& chunks) {
+  chunks.clear();
+  const size_t chunkSize = max<size_t>(1, (end - begin) / numChunks);
+  while (begin < end) {
+    const char *split = begin + min<size_t>(chunkSize, end - begin);
+    const char *eol = static_cast<const char *>(memchr(split - 1, '\n', end - (split - 1)));
+    split = eol ? eol + 1 : end;
+
+    Chunk c;
+    c.begin = begin;
+    c.end = split;
+    c.firstLine = firstLine;
+    chunks.push_back(c);
+
+    firstLine += count(begin, split, '\n');
+    begin = split;
+  }
+}
+
+// Makes a relative index absolute, and checks it
+inline int resolve(int index, bool relative, int base, int count, const char *what, const string& filename) {
+  if (relative)
+    index += base;
+  if (index < 0 || index >= count)
+    throw runtime_error("OBJ file " + filename + ": " + what + " index out of range.");
+  return index;
+}
+
+} // namespace
+
+ObjImportStats importObj(const char *filename, vector<VertexPNTBX>& vertices, vector<unsigned int>& indices,
+                         size_t blockSize) {
+  const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+
+  ifstream f(filename, ios::binary);
+  if (!f)
+    throw runtime_error(string("OBJ file ") + filename + ": cannot open.");
+
+  ThreadPool& pool = ThreadPool::getSingleton();
+  vector<glm::vec3> positions, normals;
+  vector<glm::vec2> texCoords;
+  vector<bool> needsNormal;
+
+  // Vertices are deduplicated in a table hashed by position index: the
+  // vertices sharing position v are chained from firstVertexAt[v] through
+  // nextVertexAt, and are told apart by their texture coordinate and normal
+  // indices. The chains are short, and this avoids hashing the full triplets.
+  vector<int> firstVertexAt, nextVertexAt;
+  vector<int> vertexT, vertexN;
+
+  vertices.clear();
+  indices.clear();
+
+  ObjImportStats stats;
+  stats.numBytes = 0;
+
+  vector<char> block(blockSize);
+  vector<Chunk> chunks;
+  size_t carried = 0;   // bytes of an incomplete last line, moved to the front of the block
+  int line = 1;
+  while (f || carried > 0) {
+    if (carried == block.size())
+      block.resize(block.size() * 2);   // a line longer than a block
+    f.read(&block[carried], block.size() - carried);
+    const size_t numRead = f.gcount();
+    stats.numBytes += numRead;
+    const size_t filled = carried + numRead;
+
+    // Parse up to the last complete line, or everything at the end of the file
+    size_t parseEnd = filled;
+    if (f) {
+      while (parseEnd > 0 && block[parseEnd - 1] != '\n')
+        --parseEnd;
+      if (parseEnd == 0) {
+        carried = filled;
+        continue;
+      }
+    }
+    if (parseEnd == 0)
+      break;
+
+    splitIntoChunks(&block[0], &block[0] + parseEnd, pool.getNumThreads() * 2, line, chunks);
+    pool.parallelFor(chunks.size(), [&chunks](int i) {
+      parseChunk(chunks[i]);
+    });
+
+    // Merge in file order, which resolves relative indices and deduplicates vertices
+    for (size_t i = 0; i < chunks.size(); ++i) {
+      const Chunk& c = chunks[i];
+      if (!c.error.empty())
+        throw runtime_error(string("OBJ file ") + filename + ", " + c.error);
+
+      const int vBase = positions.size(), tBase = texCoords.size(), nBase = normals.size();
+      positions.insert(positions.end(), c.positions.begin(), c.positions.end());
+      texCoords.insert(texCoords.end(), c.texCoords.begin(), c.texCoords.end());
+      normals.insert(normals.end(), c.normals.begin(), c.normals.end());
+      firstVertexAt.resize(positions.size(), -1);
+
+      for (size_t j = 0; j < c.corners.size(); ++j) {
+        const Corner& corner = c.corners[j];
+        const int v = resolve(corner.v, corner.relative & 1, vBase, positions.size(), "vertex", filename);
+        const int t = corner.t == MISSING ? -1 : resolve(corner.t, corner.relative & 2, tBase, texCoords.size(), "texture coordinate", filename);
+        const int n = corner.n == MISSING ? -1 : resolve(corner.n, corner.relative & 4, nBase, normals.size(), "normal", filename);
+
+        int id = firstVertexAt[v];
+        while (id >= 0 && (vertexT[id] != t || vertexN[id] != n))
+          id = nextVertexAt[id];
+
+        if (id < 0) {
+          id = vertices.size();
+          nextVertexAt.push_back(firstVertexAt[v]);
+          firstVertexAt[v] = id;
+          vertexT.push_back(t);
+          vertexN.push_back(n);
+
+          VertexPNTBX vertex;
+          vertex.p = positions[v];
+          vertex.x = t >= 0 ? texCoords[t] : glm::vec2(0, 0);
+          vertex.n = n >= 0 ? normals[n] : glm::vec3(0, 0, 0);
+          vertex.t = vertex.b = glm::vec3(0, 0, 0);
+          vertices.push_back(vertex);
+          needsNormal.push_back(n < 0);
+        }
+        indices.push_back(id);
+      }
+    }
+
+    line = chunks.back().firstLine + count(chunks.back().begin, chunks.back().end, '\n');
+    carried = filled - parseEnd;
+    memmove(&block[0], &block[parseEnd], carried);
+    if (!f && numRead == 0)
+      break;
+  }
+
+  // Smooth normals for the vertices that had none
+  if (find(needsNormal.begin(), needsNormal.end(), true) != needsNormal.end()) {
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) {
+      VertexPNTBX *v[3] = {&vertices[indices[i]], &vertices[indices[i + 1]], &vertices[indices[i + 2]]};
+      // the length of the cross product weights by area
+      const glm::vec3 n = glm::cross(v[1]->p - v[0]->p, v[2]->p - v[0]->p);
+      for (int k = 0; k < 3; ++k) {
+        if (needsNormal[indices[i + k]])
+          v[k]->n += n;
+      }
+    }
+    for (size_t i = 0; i < vertices.size(); ++i) {
+      if (needsNormal[i] && glm::dot(vertices[i].n, vertices[i].n) > 0)
+        vertices[i].n = glm::normalize(vertices[i].n);
+    }
+  }
+
+  stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  stats.numVertices = vertices.size();
+  stats.numTriangles = indices.size() / 3;
+  return stats;
+}
+
+shared_ptr<BufferObjectGeometry> importObjGeometry(const char *filename) {
+  vector<VertexPNTBX> vertices;
+  vector<unsigned int> indices;
+  const ObjImportStats stats = importObj(filename, vertices, indices);
+  if (indices.empty())
+    throw runtime_error(string("OBJ file ") + filename + ": no triangles.");
+
+  cout << filename << ": " << stats.numTriangles << " triangles, " << stats.numVertices << " vertices, "
+       << stats.numBytes / double(1 << 20) << " MB parsed in " << stats.seconds << "s ("
+       << stats.getMegabytesPerSecond() << " MB/s)" << endl;
+
+  const TangentStats tangentStats = generateTangents(vertices, indices);
+  cout << filename << ": tangents generated in " << tangentStats.seconds << "s ("
+       << tangentStats.getTrianglesPerSecond() / 1e6 << " M triangles/s), "
+       << tangentStats.numSplitVertices << " vertices split at mirrored seams" << endl;
+
+  optimizeMesh(vertices, indices);
+  shared_ptr<BufferObjectGeometry> geometry(new IndexedGeometryPNTBX(&vertices[0], &indices[0], vertices.size(), indices.size()));
+  geometry->setPickMesh(PickMesh::create(&vertices[0], vertices.size(), &indices[0], indices.size()));
+
+  // Coarser levels with about a quarter of the triangles of the previous one
+  // each, for every halving of the screen size below 400 pixels
+  float screenSize = 400;
+  for (int targetTriangles = indices.size() / 12; targetTriangles >= 64; targetTriangles /= 4, screenSize /= 2) {
+    vector<VertexPNTBX> lodVertices;
+    vector<unsigned int> lodIndices;
+    // clustering a closed surface on an n^3 grid leaves about 6 n^2 triangles
+    simplifyMesh(vertices, indices, max(2, int(sqrt(targetTriangles / 6.0))), lodVertices, lodIndices);
+    if (lodIndices.empty())
+      break;
+    geometry->addLod(shared_ptr<Geometry>(new IndexedGeometryPNTBX(&lodVertices[0], &lodIndices[0],
+                                                                    lodVertices.size(), lodIndices.size())),
+                     screenSize);
+    cout << filename << ": level of detail " << geometry->getNumLods() - 1 << " below " << screenSize
+         << " pixels, " << lodIndices.size() / 3 << " triangles" << endl;
+  }
+  return geometry;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+#include "geometry.h"
+
+// Figures of an OBJ import
+struct ObjImportStats {
+  size_t numBytes;
+  double seconds;
+  int numVertices, numTriangles;
+
+  double getMegabytesPerSecond() const {
+    return seconds > 0 ? numBytes / seconds / (1 << 20) : 0;
+  }
+};
+
+// Imports the triangles of a Wavefront OBJ file as an indexed triangle list,
+// with vertices deduplicated on their (position, texture coordinate, normal)
+// triplet. Polygons are triangulated as fans; vertices without a normal get
+// the area weighted average of the normals of their triangles. Tangents and
+// binormals are left zero, see generateTangents of tangentgenerator.h. Groups,
+// objects, and materials are ignored.
+//
+// The file is streamed in blocks of `blockSize' bytes, so its text is never
+// held in memory as a whole. Each block is split at line boundaries into
+// chunks that are parsed in parallel on the ThreadPool.
+//
+// Throws runtime_error if the file cannot be read or is malformed.
+ObjImportStats importObj(const char *filename, std::vector<VertexPNTBX>& vertices, std::vector<unsigned int>& indices,
+                         size_t blockSize = 16 << 20);
+
+// Imports an OBJ file into a geometry, with tangent frames, the mesh
+// optimized for the vertex cache, simplified levels of detail, and a pick
+// mesh, and prints the import figures
+std::shared_ptr<BufferObjectGeometry> importObjGeometry(const char *filename);
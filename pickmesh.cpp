@@ -0,0 +1,53 @@
+#include <cmath>
+
+#include "pickmesh.h"
+
+using namespace std;
+
+PickMesh::PickMesh(vector<glm::vec3>& positions, vector<unsigned int>& indices) {
+  positions_.swap(positions);
+  indices_.swap(indices);
+  indices_.resize(indices_.size() / 3 * 3);
+
+  vector<Aabb> bounds(getNumTriangles());
+  for (size_t i = 0; i < bounds.size(); ++i) {
+    for (int j = 0; j < 3; ++j)
+      bounds[i].extend(positions_[indices_[3 * i + j]]);
+  }
+  triangles_.build(bounds);
+}
+
+bool PickMesh::intersect(const Ray& ray, float& t) const {
+  return triangles_.raycast(ray, [this, &ray](int triangle, float& tHit) {
+    return intersectTriangle(triangle, ray, tHit);
+  }, t) >= 0;
+}
+
+// Moller-Trumbore: solves origin + t * direction = v0 + u * e1 + v * e2
+bool PickMesh::intersectTriangle(int triangle, const Ray& ray, float& t) const {
+  const glm::vec3& v0 = positions_[indices_[3 * triangle]];
+  const glm::vec3 e1 = positions_[indices_[3 * triangle + 1]] - v0;
+  const glm::vec3 e2 = positions_[indices_[3 * triangle + 2]] - v0;
+
+  const glm::vec3 p = glm::cross(ray.direction, e2);
+  const float det = glm::dot(e1, p);
+  if (fabs(det) < 1e-12f)
+    return false;   // parallel to the triangle, or degenerate triangle
+
+  const float invDet = 1.0f / det;
+  const glm::vec3 s = ray.origin - v0;
+  const float u = glm::dot(s, p) * invDet;
+  if (u < 0 || u > 1)
+    return false;
+
+  const glm::vec3 q = glm::cross(s, e1);
+  const float v = glm::dot(ray.direction, q) * invDet;
+  if (v < 0 || u + v > 1)
+    return false;
+
+  const float tHit = glm::dot(e2, q) * invDet;
+  if (tHit < 0 || tHit >= t)
+    return false;
+  t = tHit;
+  return true;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "bvh.h"
+
+// CPU copy of the triangles of a mesh, for casting rays at it, e.g., to pick
+// the object under the mouse exactly rather than by its bounds. The triangles
+// are indexed by a Bvh over their bounds, so that a ray only tests the few
+// triangles along its way:
+//
+//   geometry->setPickMesh(PickMesh::create(&vtx[0], vtx.size(), &idx[0], idx.size()));
+//   ...
+//   float t = FLT_MAX;
+//   if (geometry->getPickMesh()->intersect(objectSpaceRay, t))
+//     hitPoint = objectSpaceRay.at(t);
+class PickMesh {
+public:
+  // Takes over the triangle list given by `indices' into `positions'
+  PickMesh(std::vector<glm::vec3>& positions, std::vector<unsigned int>& indices);
+
+  // Copies the positions `p' of the vertices
+  template<typename Vertex>
+  static std::shared_ptr<PickMesh> create(const Vertex *vertices, int numVertices,
+                                          const unsigned int *indices, int numIndices) {
+    std::vector<glm::vec3> positions(numVertices);
+    for (int i = 0; i < numVertices; ++i)
+      positions[i] = vertices[i].p;
+    std::vector<unsigned int> triangles(indices, indices + numIndices);
+    return std::make_shared<PickMesh>(positions, triangles);
+  }
+
+  int getNumTriangles() const {
+    return indices_.size() / 3;
+  }
+
+  // True if the ray hits a triangle, from either side, before distance t,
+  // lowering t to the closest hit
+  bool intersect(const Ray& ray, float& t) const;
+
+private:
+  std::vector<glm::vec3> positions_;
+  std::vector<unsigned int> indices_;
+  Bvh triangles_;
+
+  bool intersectTriangle(int triangle, const Ray& ray, float& t) const;
+};
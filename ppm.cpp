@@ -1,6 +1,8 @@
 #include <cstdlib>
 #include <cstring>
 #include <cstdio>
+#include <climits>
+#include <charconv>
 #include <fstream>
 #include <iostream>
 #include <vector>
@@ -10,6 +12,7 @@
 #include <GL/glew.h>
 
 #include "ppm.h"
+#include "mappedfile.h"
 
 using namespace std;
 
@@ -27,101 +30,149 @@ void writePpmScreenshot(const int width, const int height, const char *filename)
    }
 }
 
-// Read one positive integer from a (text) file. Line beginning with
-// "#" are ignored as comments.
-static int ppmReadInteger(istream &is)
+// Skip white spaces and comments (from "#" to the end of line) starting at p.
+// Returns the first character that is neither.
+static const char *ppmSkipSpace(const char *p, const char *end)
 {
-   unsigned char ch;
-   int got = 0, done = 0, accum = 0, inComment = 0;
-   while (!done)
+   while (p != end)
    {
-      ch = is.get();
-
-      if (inComment)
-      {
-         if (ch == '\n')
-            inComment = 0;
-         continue;
-      }
-
-      if (isdigit(ch))
+      const char ch = *p;
+      if (ch == '#')
       {
-         accum = accum * 10 + ch - '0';
-         got = 1;
+         while (p != end && *p != '\n')
+            ++p;
       }
-      else if (ch == '#')
-         inComment = 1;
-      else if (!ch || !strchr(" \t\r\n", ch))
-         throw runtime_error("ppmRead: invalid character");
-      else if (got)
-         done = 1;
+      else if (ch == ' ' || ch == '\n' || ch == '\r' || ch == '\t')
+         ++p;
       else
-         ; // nothing
+         break;
    }
-   return accum;
+   return p;
 }
 
-// Read the PPM header from the input stream and initialize the width and height
-// to the appropriate values, and throws rumtime_error on invalid width/height
-static void ppmReadHeader(istream &is, int &width, int &height)
+// Read one positive integer starting at p, skipping leading white spaces and
+// comments. Returns the position right after the integer.
+static const char *ppmReadInteger(const char *p, const char *end, int &value)
 {
-   if ((width = ppmReadInteger(is)) < 0)
-   {
-      throw runtime_error("ppmRead: invalid width");
-   }
-   if ((height = ppmReadInteger(is)) < 0)
-   {
-      throw runtime_error("ppmRead: invalid height");
-   }
-   if (ppmReadInteger(is) != 255)
-   {
+   p = ppmSkipSpace(p, end);
+   if (p == end)
+      throw runtime_error("ppmRead: unexpected end of file");
+
+   unsigned int v = 0;
+   const from_chars_result r = from_chars(p, end, v);
+   if (r.ec != errc() || v > (unsigned int)INT_MAX)
+      throw runtime_error("ppmRead: invalid character");
+
+   value = (int)v;
+   return r.ptr;
+}
+
+// Parse the PPM header (after the magic number) and initialize the width and
+// height to the appropriate values. Returns the position of the first byte of
+// pixel data, and throws rumtime_error on invalid width/height
+static const char *ppmReadHeader(const char *p, const char *end, int &width, int &height)
+{
+   int maxColor;
+   p = ppmReadInteger(p, end, width);
+   p = ppmReadInteger(p, end, height);
+   p = ppmReadInteger(p, end, maxColor);
+
+   if (width <= 0 || height <= 0 || (size_t)width * (size_t)height > (size_t)INT_MAX)
+      throw runtime_error("ppmRead: invalid width/height");
+   if (maxColor != 255)
       cerr << "Warning: maxcolor not 255 : won't work well" << endl;
+
+   // exactly one white space separates the header from the pixels
+   if (p == end || !strchr(" \t\r\n", *p))
+      throw runtime_error("ppmRead: invalid character");
+   return p + 1;
+}
+
+// Decode `count' ASCII values into `out', using from_chars for the number parsing.
+// Returns the position right after the last value.
+static const char *ppmDecodeAscii(const char *p, const char *end, unsigned char *out, size_t count)
+{
+   for (size_t i = 0; i < count; ++i)
+   {
+      p = ppmSkipSpace(p, end);
+      if (p == end)
+         throw runtime_error("ppmRead: unexpected end of file");
+
+      unsigned int v = 0;
+      const from_chars_result r = from_chars(p, end, v);
+      if (r.ec != errc())
+         throw runtime_error("ppmRead: invalid character");
+      out[i] = (unsigned char)v;
+      p = r.ptr;
    }
+   return p;
 }
 
-//Reads the actual PPM data and stores returns in in a pixels.
-void ppmRead(const char *filename, int &width, int &height, std::vector<PackedPixel> &pixels)
+PpmImage::PpmImage(const char *filename)
+   : bottomRow_(NULL), rowStride_(0), width_(0), height_(0)
 {
-   ifstream is(filename, ios::binary);
-   if (!is.is_open())
+   try
+   {
+      file_.reset(new MappedFile(filename));
+   }
+   catch (const runtime_error &)
+   {
       throw runtime_error(string("ppmRead: Cannot open file ") + filename + " for read");
+   }
 
-   // Sets bits to report IO error using exception
-   is.exceptions(ios::eofbit | ios::failbit | ios::badbit);
-
-   char buf[2];
-   is.read(buf, 2);
+   const char *p = file_->data(), *end = p + file_->size();
+   if (file_->size() < 2)
+      throw runtime_error("ppmRead: bad file format");
 
    bool isbinary = false;
-   if (!memcmp(buf, "P3", 2))
+   if (!memcmp(p, "P3", 2))
       isbinary = false;
-   else if (!memcmp(buf, "P6", 2))
+   else if (!memcmp(p, "P6", 2))
       isbinary = true;
    else
       throw runtime_error("ppmRead: bad file format");
 
-   ppmReadHeader(is, width, height);
-
-   pixels.resize(width * height);
+   p = ppmReadHeader(p + 2, end, width_, height_);
 
+   const size_t numPixels = (size_t)width_ * height_;
    if (isbinary)
    {
-      for (int row = height - 1; row >= 0; row--)
-      {
-         is.read(reinterpret_cast<char *>(&pixels[row * width]), width * sizeof(PackedPixel));
-      }
+      if ((size_t)(end - p) < numPixels * sizeof(PackedPixel))
+         throw runtime_error("ppmRead: unexpected end of file");
+      file_->willNeed();
+
+      // the file stores the top row first, so walk it backwards
+      bottomRow_ = reinterpret_cast<const PackedPixel *>(p) + (numPixels - width_);
+      rowStride_ = -width_;
    }
    else
    {
-      for (int row = height - 1; row >= 0; row--)
+      // decode straight into bottom-up order so the result can be uploaded at once
+      decoded_.resize(numPixels);
+      for (int row = height_ - 1; row >= 0; row--)
       {
-         for (int l = 0; l < width; l++)
-         {
-            PackedPixel &p = pixels[row * width + l];
-            p.r = ppmReadInteger(is);
-            p.g = ppmReadInteger(is);
-            p.b = ppmReadInteger(is);
-         }
+         p = ppmDecodeAscii(p, end, reinterpret_cast<unsigned char *>(&decoded_[(size_t)row * width_]), (size_t)width_ * 3);
       }
+      bottomRow_ = &decoded_[0];
+      rowStride_ = width_;
+
+      // the text is no longer needed
+      file_.reset();
+   }
+}
+
+PpmImage::~PpmImage() {}
+
+//Reads the actual PPM data and stores returns in in a pixels.
+void ppmRead(const char *filename, int &width, int &height, std::vector<PackedPixel> &pixels)
+{
+   PpmImage image(filename);
+   width = image.width();
+   height = image.height();
+
+   pixels.resize((size_t)width * height);
+   for (int row = 0; row < height; row++)
+   {
+      memcpy(&pixels[(size_t)row * width], image.row(row), width * sizeof(PackedPixel));
    }
 }
@@ -2,6 +2,10 @@
 #define PPM_H
 
 #include <vector>
+#include <memory>
+#include <cstddef>
+
+class MappedFile;
 
 void writePpmScreenshot(const int width, const int height, const char *filename);
 
@@ -11,6 +15,37 @@ struct PackedPixel
    unsigned char r, g, b;
 };
 
+// A PPM image (P3 or P6) mapped into memory. The header is parsed once on
+// construction. Throws an exception on error.
+//
+// For binary (P6) files the pixels are not copied: row() points straight into
+// the mapped file. ASCII (P3) files are decoded once into an internal buffer.
+class PpmImage
+{
+public:
+   explicit PpmImage(const char *filename);
+   ~PpmImage();
+
+   int width() const { return width_; }
+   int height() const { return height_; }
+
+   // Pixels of one row, where row 0 is the bottom of the image as in OpenGL
+   const PackedPixel *row(int glRow) const
+   {
+      return bottomRow_ + glRow * rowStride_;
+   }
+
+private:
+   std::unique_ptr<MappedFile> file_;
+   std::vector<PackedPixel> decoded_;
+   const PackedPixel *bottomRow_;
+   std::ptrdiff_t rowStride_; // in pixels, negative when rows are read from the file
+   int width_, height_;
+
+   PpmImage(const PpmImage &);
+   const PpmImage &operator=(const PpmImage &);
+};
+
 // The image file is read into `pixels' and its dimension stored into `width'
 // and `height'. Throws an exception on error.
 void ppmRead(const char *filename, int &width, int &height, std::vector<PackedPixel> &pixels);
@@ -0,0 +1,132 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "hash.h"
+#include "programcache.h"
+
+using namespace std;
+
+// Layout of a cache file: this header, then the program binary, then the user data
+struct ProgramCacheHeader {
+  char magic[8];
+  uint64_t key;           // getProgramCacheKey of the sources the binary was built from
+  uint32_t binaryFormat;  // as returned by glGetProgramBinary
+  uint32_t binarySize;
+  uint32_t userDataSize;
+  uint32_t padding;
+};
+
+static const char kProgramCacheMagic[8] = { 'K', 'F', 'P', 'R', 'O', 'G', '1', '\n' };
+
+static const vector<GLint>& getBinaryFormats() {
+  static vector<GLint> formats;
+  static bool queried = false;
+  if (!queried) {
+    GLint numFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    formats.resize(numFormats);
+    if (numFormats > 0)
+      glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, &formats[0]);
+    queried = true;
+  }
+  return formats;
+}
+
+bool isProgramBinaryCacheSupported() {
+  return !getBinaryFormats().empty();
+}
+
+static uint64_t hashString(const GLubyte *s, uint64_t seed) {
+  // A separator, so that moving characters between strings changes the hash
+  const char separator = 0;
+  if (s)
+    seed = fnv1aHash(s, strlen(reinterpret_cast<const char *>(s)), seed);
+  return fnv1aHash(&separator, 1, seed);
+}
+
+uint64_t getProgramCacheKey(const vector<char>& vsSource, const vector<char>& fsSource) {
+  const uint64_t vsSize = vsSource.size(), fsSize = fsSource.size();
+  uint64_t h = fnv1aHash(&vsSize, sizeof(vsSize));
+  h = fnv1aHash(vsSource.data(), vsSource.size(), h);
+  h = fnv1aHash(&fsSize, sizeof(fsSize), h);
+  h = fnv1aHash(fsSource.data(), fsSource.size(), h);
+  h = hashString(glGetString(GL_VENDOR), h);
+  h = hashString(glGetString(GL_RENDERER), h);
+  return hashString(glGetString(GL_VERSION), h);
+}
+
+bool loadProgramBinary(const string& cacheFileName, uint64_t key, GLuint program, string& userData) {
+  ifstream f(cacheFileName.c_str(), ios::binary);
+  if (!f)
+    return false;  // no cache yet
+
+  ProgramCacheHeader header;
+  if (!f.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+      memcmp(header.magic, kProgramCacheMagic, sizeof(kProgramCacheMagic)) || header.key != key)
+    return false;
+
+  // glProgramBinary raises GL_INVALID_ENUM for formats the driver no longer offers
+  const vector<GLint>& formats = getBinaryFormats();
+  if (find(formats.begin(), formats.end(), GLint(header.binaryFormat)) == formats.end())
+    return false;
+
+  vector<char> binary(header.binarySize);
+  userData.resize(header.userDataSize);
+  if (binary.empty() ||
+      !f.read(&binary[0], binary.size()) ||
+      (!userData.empty() && !f.read(&userData[0], userData.size())))
+    return false;
+
+  glProgramBinary(program, header.binaryFormat, &binary[0], binary.size());
+  GLint linked = 0;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  return linked != 0;
+}
+
+void saveProgramBinary(const string& cacheFileName, uint64_t key, GLuint program, const string& userData) {
+  GLint binarySize = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &binarySize);
+  if (binarySize <= 0)
+    return;
+
+  vector<char> binary(binarySize);
+  GLenum binaryFormat;
+  GLsizei length = 0;
+  glGetProgramBinary(program, binarySize, &length, &binaryFormat, &binary[0]);
+  if (length <= 0)
+    return;
+
+  ProgramCacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kProgramCacheMagic, sizeof(kProgramCacheMagic));
+  header.key = key;
+  header.binaryFormat = binaryFormat;
+  header.binarySize = length;
+  header.userDataSize = userData.size();
+
+  const string tmpFileName = cacheFileName + ".tmp";
+  {
+    ofstream f(tmpFileName.c_str(), ios::binary);
+    f.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    f.write(&binary[0], length);
+    f.write(userData.data(), userData.size());
+    if (!f) {
+      cerr << "WARN: cannot write program cache " << cacheFileName << endl;
+      f.close();
+      remove(tmpFileName.c_str());
+      return;
+    }
+  }
+  // write then rename, so that a concurrent reader never sees a partial file
+  remove(cacheFileName.c_str());
+  if (rename(tmpFileName.c_str(), cacheFileName.c_str()) != 0) {
+    cerr << "WARN: cannot write program cache " << cacheFileName << endl;
+    remove(tmpFileName.c_str());
+  }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "glsupport.h"
+
+// Disk cache of linked program binaries (glGetProgramBinary), so that programs
+// built on a previous launch skip GLSL compilation and linking. Each entry also
+// stores an opaque blob of the caller, e.g., the reflected uniforms and attributes,
+// so that the program need not be queried again either.
+//
+// Binaries are only valid for the driver that produced them, hence entries are
+// keyed by the shader sources together with the GL vendor, renderer and version.
+// Drivers may still reject a binary (e.g., after an update that kept the version
+// string), in which case the caller builds the program from source as usual:
+//
+//   const uint64_t key = getProgramCacheKey(vsSource, fsSource);
+//   if (!loadProgramBinary(fileName, key, program, reflection)) {
+//     glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+//     linkShader(program, vs, fs);
+//     saveProgramBinary(fileName, key, program, reflection);
+//   }
+
+// False if the driver supports no binary format, making the cache a no-op
+bool isProgramBinaryCacheSupported();
+
+// Hash of the sources of a program and of the strings identifying the driver
+uint64_t getProgramCacheKey(const std::vector<char>& vsSource, const std::vector<char>& fsSource);
+
+// Loads the binary cached under `key' into `program', and the blob stored with it
+// into `userData'. Returns false if there is no such entry, or if the driver does
+// not link the binary.
+bool loadProgramBinary(const std::string& cacheFileName, uint64_t key, GLuint program, std::string& userData);
+
+// Saves the binary of a program linked with GL_PROGRAM_BINARY_RETRIEVABLE_HINT set.
+// Failures (e.g., read-only directory) only cost the next launch the compilation,
+// hence are reported but not fatal.
+void saveProgramBinary(const std::string& cacheFileName, uint64_t key, GLuint program, const std::string& userData);
@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <cstring>
+
+#include "renderqueue.h"
+
+using namespace std;
+
+// Layout of the sort keys, from the most significant bit:
+//
+//   opaque:   0 | program (10) | texture set (14) | states (14) | depth (24)
+//   blended:  1 | far-to-near depth (24) | program (10) | texture set (14) | states (14)
+//
+// Bit 63 puts all blended draws after the opaque ones. Ids larger than their
+// field wrap around, which only costs some grouping, never correctness.
+
+static const int kProgramBits = 10, kTextureSetBits = 14, kStatesBits = 14, kDepthBits = 24;
+
+static uint64_t maskBits(uint64_t value, int bits) {
+  return value & ((uint64_t(1) << bits) - 1);
+}
+
+// Orders non-negative depths by the top bits of their IEEE representation
+static uint64_t quantizeDepth(float depth) {
+  depth = max(depth, 0.0f);
+  uint32_t bits;
+  memcpy(&bits, &depth, sizeof(bits));
+  return bits >> (32 - kDepthBits);
+}
+
+void RenderQueue::add(Material& material, Geometry& geometry, const Uniforms& uniforms, float eyeDepth) {
+  const RenderStates& rs = material.getRenderStates();
+  const uint64_t materialBits = (maskBits(material.getProgramSortId(), kProgramBits) << (kTextureSetBits + kStatesBits)) |
+                                (maskBits(material.getTextureSetId(), kTextureSetBits) << kStatesBits) |
+                                maskBits(rs.getSortKey(), kStatesBits);
+  const uint64_t depth = quantizeDepth(eyeDepth);
+
+  uint64_t key;
+  if (rs.isEnabled(GL_BLEND)) {
+    const uint64_t farToNear = maskBits(~depth, kDepthBits);
+    key = (uint64_t(1) << 63) | (farToNear << (kProgramBits + kTextureSetBits + kStatesBits)) | materialBits;
+  }
+  else {
+    key = (materialBits << kDepthBits) | depth;
+  }
+
+  if (numPackets_ == (int)packets_.size())
+    packets_.push_back(Packet());
+  Packet& p = packets_[numPackets_];
+  p.material = &material;
+  p.geometry = &geometry;
+  p.uniforms = uniforms;
+
+  keys_.push_back(make_pair(key, numPackets_++));
+}
+
+void RenderQueue::submit() {
+  sort(keys_.begin(), keys_.end());
+
+  for (size_t i = 0; i < keys_.size(); ++i) {
+    Packet& p = packets_[keys_[i].second];
+    p.material->draw(*p.geometry, p.uniforms);
+  }
+
+  keys_.clear();
+  numPackets_ = 0;
+}
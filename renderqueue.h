@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "material.h"
+
+// Collects the draws of a frame and submits them in an order that minimizes
+// GL state changes:
+//
+// - opaque draws first, grouped by program, then by texture set, then by
+//   render states, and front to back within a group for early depth rejection
+// - blended draws (materials with GL_BLEND enabled) last, back to front
+//
+// The material and geometry of each draw are stored by reference, and must
+// stay alive until submit() returns. The per-draw uniforms are copied.
+class RenderQueue {
+public:
+  RenderQueue() : numPackets_(0) {}
+
+  // Queues `geometry' to be drawn by `material'. `eyeDepth' is the distance
+  // of the object in front of the eye (i.e., -z in eye space) used for sorting.
+  void add(Material& material, Geometry& geometry, const Uniforms& uniforms, float eyeDepth);
+
+  // Draws all queued draws in sorted order and empties the queue
+  void submit();
+
+  int size() const {
+    return numPackets_;
+  }
+
+private:
+  struct Packet {
+    Material *material;
+    Geometry *geometry;
+    Uniforms uniforms;
+  };
+
+  // Packets are kept in insertion order; only the (key, index) pairs get
+  // sorted. Slots past numPackets_ are kept from earlier frames for reuse.
+  std::vector<Packet> packets_;
+  std::vector<std::pair<uint64_t, int> > keys_;
+  int numPackets_;
+};
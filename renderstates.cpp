@@ -38,7 +38,6 @@ RenderStates& RenderStates::blendFunc(GLenum sfactor, GLenum dfactor) {
   // future TODO: should check if sfactor and dfactor are valid enums
   glBlendSrcFactor = sfactor;
   glBlendDstFactor = dfactor;
-  glBlendFunc(sfactor, dfactor);
 
   return *this;
 }
@@ -76,44 +75,49 @@ RenderStates& RenderStates::disable(GLenum target) {
   throw invalid_argument("RenderStates::glEnable: unsupported target");
 }
 
-void RenderStates::apply() const {
-  static bool firstRun = false;
-  static RenderStates currentRs;
-  if (firstRun) {
-    currentRs.captureFromGl();
-    firstRun = false;
-  }
-
-  if (glFrontAndBack != currentRs.glFrontAndBack) {
-    ::glPolygonMode(GL_FRONT_AND_BACK, glFrontAndBack);
-    currentRs.glFrontAndBack = glFrontAndBack;
-  }
-  if (glBlendSrcFactor != currentRs.glBlendSrcFactor || glBlendDstFactor != currentRs.glBlendDstFactor) {
-    ::glBlendFunc(glBlendSrcFactor, glBlendDstFactor);
-    currentRs.glBlendSrcFactor = glBlendSrcFactor;
-    currentRs.glBlendDstFactor = glBlendDstFactor;
+bool RenderStates::isEnabled(GLenum target) const {
+  switch (target) {
+  case GL_BLEND:
+    return (flags & kBlendBit) != 0;
+  case GL_CULL_FACE:
+    return (flags & kCullFaceBit) != 0;
+  default:
+    ;
   }
+  throw invalid_argument("RenderStates::isEnabled: unsupported target");
+}
 
-  if (glCullFaceMode != currentRs.glCullFaceMode) {
-    ::glCullFace(glCullFaceMode);
-    currentRs.glCullFaceMode = glCullFaceMode;
+// Index of a blend factor in 4 bits. The rarely used ones share the last value.
+static unsigned int getBlendFactorIndex(GLenum factor) {
+  static const GLenum factors[] = {
+    GL_ZERO, GL_ONE, GL_SRC_COLOR, GL_ONE_MINUS_SRC_COLOR, GL_DST_COLOR, GL_ONE_MINUS_DST_COLOR,
+    GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_DST_ALPHA, GL_ONE_MINUS_DST_ALPHA,
+    GL_CONSTANT_COLOR, GL_ONE_MINUS_CONSTANT_COLOR, GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA,
+  };
+  unsigned int i = 0;
+  for (const unsigned int n = sizeof(factors) / sizeof(factors[0]); i < n; ++i) {
+    if (factors[i] == factor)
+      break;
   }
+  return i;
+}
 
-  if ((flags & kBlendBit) != (currentRs.flags & kBlendBit)) {
-    if (flags & kBlendBit)
-      ::glEnable(GL_BLEND);
-    else
-      ::glDisable(GL_BLEND);
-    currentRs.flags = (currentRs.flags & (~kBlendBit)) | (flags & kBlendBit);
-  }
+unsigned int RenderStates::getSortKey() const {
+  const unsigned int polygonMode = glFrontAndBack - GL_POINT;  // GL_POINT, GL_LINE, GL_FILL are consecutive
+  const unsigned int cullFace = glCullFaceMode == GL_FRONT ? 0 : (glCullFaceMode == GL_BACK ? 1 : 2);
+  return (flags & 3) << 12 | polygonMode << 10 | cullFace << 8 |
+         getBlendFactorIndex(glBlendSrcFactor) << 4 | getBlendFactorIndex(glBlendDstFactor);
+}
 
-  if ((flags & kCullFaceBit) != (currentRs.flags & kCullFaceBit)) {
-    if (flags & kCullFaceBit)
-      ::glEnable(GL_CULL_FACE);
-    else
-      ::glDisable(GL_CULL_FACE);
-    currentRs.flags = (currentRs.flags & (~kCullFaceBit)) | (flags & kCullFaceBit);
-  }
+// The current GL state is shadowed by GlStateCache, which starts out unknown,
+// so the first draw always sets every state
+void RenderStates::apply() const {
+  GlStateCache& gl = GlStateCache::getSingleton();
+  gl.polygonMode(glFrontAndBack);
+  gl.blendFunc(glBlendSrcFactor, glBlendDstFactor);
+  gl.cullFace(glCullFaceMode);
+  gl.setEnabled(GL_BLEND, (flags & kBlendBit) != 0);
+  gl.setEnabled(GL_CULL_FACE, (flags & kCullFaceBit) != 0);
 }
 
 void RenderStates::captureFromGl() {
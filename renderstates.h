@@ -30,6 +30,11 @@ public:
   RenderStates& enable(GLenum target);
   RenderStates& disable(GLenum target);
 
+  bool isEnabled(GLenum target) const;
+
+  // The states packed into 14 bits, so that draws can be sorted by states
+  unsigned int getSortKey() const;
+
   void apply() const;
   void captureFromGl();
 };
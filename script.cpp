@@ -1,17 +1,9 @@
-#pragma once 
-
 #include "script.h"
 #include <assert.h>
-#include <glm/glm.hpp>
-#include <glm/ext.hpp>
-
-#include <glm/gtx/string_cast.hpp>
-#include <glm/gtx/norm.hpp>
-#include <glm/gtx/transform.hpp>      // rotation, translation, scaling transforms
 
 using namespace std;
 
-Script::Script(std::vector<glm::mat4 *> objects)
+Script::Script(std::vector<Rbt *> objects)
 {
     for (int i = 0; i < objects.size(); i++)
         scene.push_back(objects[i]);
@@ -167,7 +159,9 @@ void Script::write_script(string filename)
     {
         for (int i = 0; i < scene.size(); i++)
         {
-            float *a = glm::value_ptr(it->at(i));
+            // frames are stored as 4x4 matrices
+            const glm::mat4 m = it->at(i).toMatrix();
+            const float *a = glm::value_ptr(m);
             for (int k = 0; k < 16; k++)
                 file << a[k] << ",";
             file << ' ';   // space to separate object frames
@@ -195,7 +189,8 @@ void Script::print_current()
 {
     for (int i = 0; i < scene.size(); i++)
     {
-        float *a = glm::value_ptr(current_frame->at(i));
+        const glm::mat4 m = current_frame->at(i).toMatrix();
+        const float *a = glm::value_ptr(m);
         for (int k = 0; k < 16; k++)
             std::cout << a[k] << ",";
         std::cout << std::endl;
@@ -236,62 +231,29 @@ void Script::interpolate_from_current(float alpha)
 
 bool Script::interpolate(float t)
 {
-  float alpha = t - glm::floor(t);
-
   if (nkeyframes() - 1 - t < 0.0001) //We are done with the animation
   {
       return true;
   }
 
-  else if (t != 0.0f && (abs(alpha) < 0.0001 || abs(alpha) > 0.9999)  ) //This means that we crossed a new integer, so we go to the next frame.
+  // Playback advances t by the measured frame time, which may skip past one
+  // or more keyframes between two calls
+  const int frame = (int) glm::floor(t);
+  while (current_frame_number < frame)
   {
       current_frame++;
-      interpolate_from_current(alpha);
-      std::cout << "pointer incremented " << t << std::endl;
-      return false;
-  }
-
-  else
-  {
-      std::cout << "t = " << t << " and alpha = " << alpha << std::endl;
-      interpolate_from_current(alpha);
-      return false;
+      current_frame_number++;
   }
+  interpolate_from_current(t - frame);
+  return false;
 }
 
-// interpolate two RBTs represented by glm::mat4s
-glm::mat4 Script::interpolate(glm::mat4 &first, glm::mat4 &second, float alpha)
+// interpolate two RBTs: lerp the translations and slerp the rotations
+Rbt Script::interpolate(const Rbt &first, const Rbt &second, float alpha)
 {
-    //Translation
-    glm::vec3 first_translation = glm::vec3(first[3]);
-    glm::vec3 second_translation = glm::vec3(second[3]);
-
-    glm::vec3 lerped = ((1 - alpha) * first_translation) + (alpha * second_translation);
-    glm::mat4 translation_RBT = glm::translate(glm::mat4(1.0f), lerped);
-   
-
-    //Rotation
-
-    /*glm::quat cube1rot = glm::quat_cast(first);
-    glm::quat cube2rot = glm::quat_cast(second);
-
-    glm::quat interpolated_quat = glm::mix(cube1rot, cube2rot, 0.0f);
-
-    if (interpolated_quat == cube1rot)
-    {
-        std::cout << "Happy carrot." << std::endl;
-    }*/
-
-    glm::quat first_rotation = glm::quat(first);
-    glm::quat second_rotation = glm::quat(second);
-    glm::quat slerped = glm::slerp(first_rotation, second_rotation, alpha);
-    glm::mat4 rotation_RBT = glm::mat4(slerped);
-    //glm::mat4 rotation_RBT = glm::mat4(first_rotation);
-    //Combining
-    glm::mat4 interpolated = translation_RBT*rotation_RBT;
-
-    return interpolated; 
-
+    const glm::vec3 lerped = ((1 - alpha) * first.t) + (alpha * second.t);
+    const glm::quat slerped = glm::slerp(first.r, second.r, alpha);
+    return Rbt(lerped, slerped);
 }
 
 // interpolate two keyframes
@@ -301,10 +263,7 @@ keyframe Script::interpolate(keyframe& first, keyframe& second, float alpha)
     keyframe interpolated;
     for (int i = 0; i < first.size(); i++)
     {
-        //interpolated->push_back(interpolate(first[i], second[i], alpha));
-        glm::mat4 first_mat = first[i];
-        glm::mat4 second_mat = second[i];
-        interpolated.push_back(interpolate(first_mat, second_mat, alpha));
+        interpolated.push_back(interpolate(first[i], second[i], alpha));
     }
 
     //return *interpolated;
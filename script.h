@@ -7,21 +7,20 @@
 #include <list>
 #include <iterator>     
 
-#include <glm/glm.hpp>
-#include <glm/ext.hpp>
+#include "glmutils.h"
 
 
-typedef std::vector<glm::mat4> keyframe;       // 4x4 coordinate frames of objects being animated
+typedef std::vector<Rbt> keyframe;             // rigid body frames of objects being animated
 
 class Script {
-    std::vector<glm::mat4*> scene;               // pointers to objects in scene
+    std::vector<Rbt*> scene;                     // pointers to objects in scene
     std::list<keyframe> keyframes; 
     std::list<keyframe>::iterator current_frame;
 
     int current_frame_number;                    // for animation playback
 
 public:
-    Script(std::vector<glm::mat4*> objects); 
+    Script(std::vector<Rbt*> objects); 
 
     void copy_to_scene();                        // copy current keyframe to scene
     void copy_frame_to_scene(keyframe & kf);     // copy a frame to scene
@@ -44,8 +43,8 @@ public:
     void interpolate_from_current(float alpha);   // 0 <= alpha < 1, copies to scene
     bool interpolate(float t);                    // called from animation/rendering loop
 
-    // interpolate two RBTs represented by glm::mat4s
-    static glm::mat4 interpolate(glm::mat4 & first, glm::mat4 & second, float alpha);
+    // interpolate two RBTs
+    static Rbt interpolate(const Rbt & first, const Rbt & second, float alpha);
     // interpolate two keyframes 
     static keyframe interpolate(keyframe & first, keyframe & second, float alpha);
 };
@@ -1,6 +1,12 @@
 #version 410
 
-uniform mat4 uProjMatrix;
+// shared by all programs, set once per frame
+layout(std140) uniform FrameBlock {
+  mat4 uProjMatrix;
+  vec3 uLight;    // lights in eye space
+  vec3 uLight2;
+};
+
 uniform mat4 uModelViewMatrix;
 uniform mat4 uNormalMatrix;
 
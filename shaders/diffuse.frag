@@ -1,6 +1,17 @@
 #version 410
 
-uniform vec3 uLight, uLight2, uColor;
+// shared by all programs, set once per frame
+layout(std140) uniform FrameBlock {
+  mat4 uProjMatrix;
+  vec3 uLight;    // lights in eye space
+  vec3 uLight2;
+};
+
+// set once per material
+layout(std140) uniform MaterialBlock {
+  vec3 uColor;
+};
+
 uniform sampler2D uTexColor;
 
 in vec3 vNormal;
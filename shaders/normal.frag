@@ -3,9 +3,12 @@
 uniform sampler2D uTexColor;
 uniform sampler2D uTexNormal;
 
-// lights in eye space
-uniform vec3 uLight;
-uniform vec3 uLight2;
+// shared by all programs, set once per frame
+layout(std140) uniform FrameBlock {
+  mat4 uProjMatrix;
+  vec3 uLight;    // lights in eye space
+  vec3 uLight2;
+};
 
 in vec2 vTexCoord;
 in mat3 vNTMat;
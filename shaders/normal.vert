@@ -1,13 +1,18 @@
 #version 410
 
-uniform mat4 uProjMatrix;
+// shared by all programs, set once per frame
+layout(std140) uniform FrameBlock {
+  mat4 uProjMatrix;
+  vec3 uLight;    // lights in eye space
+  vec3 uLight2;
+};
+
 uniform mat4 uModelViewMatrix;
 uniform mat4 uNormalMatrix;
 
 in vec3 aPosition;
 in vec3 aNormal;
-in vec3 aTangent;
-in vec3 aBinormal;
+in vec4 aTangent;  // w holds the sign of the binormal, 1 if not supplied
 in vec2 aTexCoord;
 
 out vec2 vTexCoord;
@@ -16,7 +21,8 @@ out vec3 vEyePos; // position in eye space
 
 void main() {
   vTexCoord = aTexCoord;
-  vNTMat = mat3(uNormalMatrix) * mat3(aTangent, aBinormal, aNormal);
+  vec3 binormal = cross(aNormal, aTangent.xyz) * aTangent.w;
+  vNTMat = mat3(uNormalMatrix) * mat3(aTangent.xyz, binormal, aNormal);
   vec4 posE = uModelViewMatrix * vec4(aPosition, 1.0);
   vEyePos = posE.xyz;
   gl_Position = uProjMatrix * posE;
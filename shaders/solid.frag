@@ -1,6 +1,9 @@
 #version 410
 
-uniform vec3 uColor;
+// set once per material
+layout(std140) uniform MaterialBlock {
+  vec3 uColor;
+};
 
 out vec4 fragColor;
 
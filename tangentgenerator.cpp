@@ -0,0 +1,153 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#include "tangentgenerator.h"
+#include "threadpool.h"
+
+using namespace std;
+
+namespace {
+
+// Splits [0, n) into ranges for parallelFor. Several ranges per thread
+// balance the load when some ranges take longer.
+struct Ranges {
+  int n, numRanges;
+
+  Ranges(int n, int numThreads) : n(n), numRanges(min(n, numThreads * 4)) {}
+
+  int begin(int i) const {
+    return int((long long)n * i / numRanges);
+  }
+
+  int end(int i) const {
+    return int((long long)n * (i + 1) / numRanges);
+  }
+};
+
+// Per triangle: tangent along u, and whether the texture is mirrored
+struct FaceTangent {
+  glm::vec3 t;
+  bool valid, mirrored;
+};
+
+// Angle of the triangle corner at a, between the edges towards b and c
+inline float cornerAngle(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+  const glm::vec3 e1 = b - a, e2 = c - a;
+  const float l = sqrt(glm::dot(e1, e1) * glm::dot(e2, e2));
+  return l > 0 ? acos(max(-1.0f, min(1.0f, glm::dot(e1, e2) / l))) : 0;
+}
+
+inline glm::vec3 projectOnPlane(const glm::vec3& t, const glm::vec3& n) {
+  return t - n * glm::dot(n, t);
+}
+
+inline glm::vec3 anyOrthogonal(const glm::vec3& n) {
+  const glm::vec3 axis = fabs(n.x) < 0.9f ? glm::vec3(1, 0, 0) : glm::vec3(0, 1, 0);
+  return glm::normalize(projectOnPlane(axis, n));
+}
+
+} // namespace
+
+TangentStats generateTangents(vector<VertexPNTBX>& vertices, vector<unsigned int>& indices) {
+  const chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  ThreadPool& pool = ThreadPool::getSingleton();
+
+  const int numTriangles = indices.size() / 3;
+  const int numVertices = vertices.size();
+
+  // 1. Tangent of each triangle, over ranges of triangles
+  vector<FaceTangent> faces(numTriangles);
+  const Ranges triangleRanges(numTriangles, pool.getNumThreads());
+  pool.parallelFor(triangleRanges.numRanges, [&](int r) {
+    for (int f = triangleRanges.begin(r), e = triangleRanges.end(r); f < e; ++f) {
+      const VertexPNTBX& v0 = vertices[indices[3 * f]];
+      const VertexPNTBX& v1 = vertices[indices[3 * f + 1]];
+      const VertexPNTBX& v2 = vertices[indices[3 * f + 2]];
+      const glm::vec3 e1 = v1.p - v0.p, e2 = v2.p - v0.p;
+      const glm::vec2 d1 = v1.x - v0.x, d2 = v2.x - v0.x;
+
+      // twice the signed area in texture space
+      const float det = d1.x * d2.y - d2.x * d1.y;
+      const glm::vec3 t = e1 * d2.y - e2 * d1.y;
+      FaceTangent& ft = faces[f];
+      ft.valid = det != 0 && glm::dot(t, t) > 0;
+      ft.mirrored = det < 0;
+      ft.t = ft.valid ? t / (det < 0 ? -sqrt(glm::dot(t, t)) : sqrt(glm::dot(t, t))) : glm::vec3(0);
+    }
+  });
+
+  // 2. Corners around each vertex, stored CSR style
+  vector<int> offsets(numVertices + 1, 0), corners(indices.size());
+  for (size_t i = 0; i < indices.size(); ++i)
+    ++offsets[indices[i] + 1];
+  for (int v = 0; v < numVertices; ++v)
+    offsets[v + 1] += offsets[v];
+  {
+    vector<int> fill(offsets.begin(), offsets.end() - 1);
+    for (size_t i = 0; i < indices.size(); ++i)
+      corners[fill[indices[i]]++] = i;
+  }
+
+  // 3. Angle weighted sums around each vertex, over ranges of vertices,
+  // separately for triangles with and without mirrored texture
+  vector<glm::vec3> mirroredTangents(numVertices);
+  vector<char> needsSplit(numVertices, 0);
+  const Ranges vertexRanges(numVertices, pool.getNumThreads());
+  pool.parallelFor(vertexRanges.numRanges, [&](int r) {
+    for (int v = vertexRanges.begin(r), e = vertexRanges.end(r); v < e; ++v) {
+      VertexPNTBX& vertex = vertices[v];
+      glm::vec3 sum[2] = {glm::vec3(0), glm::vec3(0)};
+      bool used[2] = {false, false};
+
+      for (int c = offsets[v]; c < offsets[v + 1]; ++c) {
+        const int f = corners[c] / 3, k = corners[c] % 3;
+        if (!faces[f].valid)
+          continue;
+        const glm::vec3 t = projectOnPlane(faces[f].t, vertex.n);
+        const float l = glm::dot(t, t);
+        if (l <= 0)
+          continue;
+        const float angle = cornerAngle(vertices[indices[3 * f + k]].p,
+                                        vertices[indices[3 * f + (k + 1) % 3]].p,
+                                        vertices[indices[3 * f + (k + 2) % 3]].p);
+        sum[faces[f].mirrored] += t * (angle / sqrt(l));
+        used[faces[f].mirrored] = true;
+      }
+
+      const int side = used[0] || !used[1] ? 0 : 1;
+      const glm::vec3 t = glm::dot(sum[side], sum[side]) > 0 ? glm::normalize(sum[side]) : anyOrthogonal(vertex.n);
+      vertex.t = t;
+      vertex.b = glm::cross(vertex.n, t) * (side ? -1.0f : 1.0f);
+
+      if (used[0] && used[1]) {
+        needsSplit[v] = 1;
+        mirroredTangents[v] = glm::dot(sum[1], sum[1]) > 0 ? glm::normalize(sum[1]) : t;
+      }
+    }
+  });
+
+  // 4. Duplicate the vertices at mirrored seams for their mirrored triangles
+  int numSplit = 0;
+  for (int v = 0; v < numVertices; ++v) {
+    if (!needsSplit[v])
+      continue;
+    VertexPNTBX copy = vertices[v];
+    copy.t = mirroredTangents[v];
+    copy.b = -glm::cross(copy.n, copy.t);
+    const unsigned int id = vertices.size();
+    vertices.push_back(copy);
+    ++numSplit;
+
+    for (int c = offsets[v]; c < offsets[v + 1]; ++c) {
+      if (faces[corners[c] / 3].valid && faces[corners[c] / 3].mirrored)
+        indices[corners[c]] = id;
+    }
+  }
+
+  TangentStats stats;
+  stats.numTriangles = numTriangles;
+  stats.numSplitVertices = numSplit;
+  stats.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  return stats;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <vector>
+
+#include "geometry.h"
+
+// Figures of a tangent generation
+struct TangentStats {
+  int numTriangles;
+  int numSplitVertices;   // vertices duplicated at mirrored texture seams
+  double seconds;
+
+  double getTrianglesPerSecond() const {
+    return seconds > 0 ? numTriangles / seconds : 0;
+  }
+};
+
+// Computes the tangent frames of an indexed triangle list from its positions,
+// normals, and texture coordinates, following the MikkTSpace conventions:
+//
+// - the tangent of each triangle follows the u direction of the texture, and
+//   is projected onto the tangent plane of each of its vertices
+// - the contributions of the triangles to a vertex are weighted by their
+//   angles at the vertex, and are normalized
+// - the binormal is cross(n, t), negated where the texture is mirrored, so
+//   shaders can rebuild it from the normal, the tangent, and a sign
+//
+// Vertices shared by triangles of opposite texture orientation are split, and
+// the indices updated. Triangles with degenerate texture coordinates do not
+// contribute; vertices left without a tangent get any vector orthogonal to
+// the normal.
+//
+// Writes VertexPNTBX::t and b. Triangle and vertex ranges are processed in
+// parallel on the ThreadPool.
+TangentStats generateTangents(std::vector<VertexPNTBX>& vertices, std::vector<unsigned int>& indices);
@@ -1,28 +1,178 @@
+#include <string>
 #include <vector>
+#include <algorithm>
+#include <limits>
 
-#include "ppm.h"
+#include <sys/stat.h>
+
+#include "mipcache.h"
+#include "textureloader.h"
 #include "glsupport.h"
 #include "texture.h"
 
 using namespace std;
 
-ImageTexture::ImageTexture(const char* ppmFileName, bool srgb) {
-  int width, height;
-  vector<PackedPixel> pixData;
-  ppmRead(ppmFileName, width, height, pixData);
+ImageTexture::ImageTexture(bool srgb)
+  : width_(0), height_(0), srgb_(srgb), ready_(false) {}
+
+ImageTexture::ImageTexture(const char* ppmFileName, bool srgb)
+  : width_(0), height_(0), srgb_(srgb), ready_(false) {
+  // Reads the precomputed levels from the sidecar cache when possible, so
+  // that neither the PPM decoding nor glGenerateMipmap are needed
+  MipChain mips;
+  loadMipChain(ppmFileName, srgb, mips);
+  upload(mips);
+}
 
-  glBindTexture(GL_TEXTURE_2D, tex);
+void ImageTexture::upload(const MipChain& mips, GLuint pixelBuffer) {
+  GlStateCache& gl = GlStateCache::getSingleton();
+  const int numLevels = mips.getNumLevels();
 
-  glTexImage2D(GL_TEXTURE_2D, 0, srgb ? GL_SRGB : GL_RGB, width, height,
-               0, GL_RGB, GL_UNSIGNED_BYTE, &pixData[0]);
+  // Levels are either pointers to client memory, or offsets into the pixel buffer
+  vector<const GLvoid*> levelData(numLevels);
+  size_t offset = 0;
+  gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+  for (int i = 0; i < numLevels; ++i) {
+    const MipChain::Level& level = mips.getLevel(i);
+    levelData[i] = pixelBuffer ? reinterpret_cast<const GLvoid*>(offset) : level.data;
+    offset += (size_t)level.width * level.height * 4;
+  }
 
+  gl.bindTexture(GL_TEXTURE_2D, tex);
 
-  glGenerateMipmap(GL_TEXTURE_2D);
+  for (int i = 0; i < numLevels; ++i) {
+    const MipChain::Level& level = mips.getLevel(i);
+    glTexImage2D(GL_TEXTURE_2D, i, mips.getInternalFormat(), level.width, level.height,
+                 0, GL_RGBA, GL_UNSIGNED_BYTE, levelData[i]);
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, numLevels - 1);
 
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 
+  if (pixelBuffer)
+    gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
   checkGlErrors();
+
+  width_ = mips.getLevel(0).width;
+  height_ = mips.getLevel(0).height;
+  ready_ = true;
+}
+
+GLuint ImageTexture::getPlaceholder(bool srgb) {
+  // Mid grey for color textures, and a flat normal for linear ones, which
+  // are mostly normal maps. Never freed, as they are used until exit.
+  static GlTexture *placeholders[2] = { NULL, NULL };
+
+  GlTexture*& placeholder = placeholders[srgb ? 1 : 0];
+  if (placeholder == NULL) {
+    const unsigned char texel[4] = { 128, 128, (unsigned char)(srgb ? 128 : 255), 255 };
+    placeholder = new GlTexture();
+    GlStateCache::getSingleton().bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    GlStateCache::getSingleton().bindTexture(GL_TEXTURE_2D, *placeholder);
+    glTexImage2D(GL_TEXTURE_2D, 0, srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, texel);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    checkGlErrors();
+  }
+  return *placeholder;
+}
+
+size_t ImageTexture::getMemoryUsage() const {
+  if (!ready_)
+    return 0;
+
+  // RGBA8 levels, down to 1x1
+  size_t bytes = 0;
+  for (int w = width_, h = height_; ; w = max(w / 2, 1), h = max(h / 2, 1)) {
+    bytes += (size_t)w * h * 4;
+    if (w == 1 && h == 1)
+      break;
+  }
+  return bytes;
+}
+
+// Returns the last modification time of a file, or 0 if it cannot be determined
+static time_t getModificationTime(const string& filename) {
+  struct stat st;
+  if (stat(filename.c_str(), &st) != 0)
+    return 0;
+  return st.st_mtime;
+}
+
+shared_ptr<ImageTexture> ImageTextureLibrary::getTexture(const string& ppmFileName, bool srgb, bool async) {
+  Key key;
+  key.filename = ppmFileName;
+  key.srgb = srgb;
+  key.modificationTime = getModificationTime(ppmFileName);
+
+  TextureMap::iterator i = textureMap.find(key);
+  if (i != textureMap.end()) {
+    shared_ptr<ImageTexture> texture = i->second.lock();
+    if (texture)
+      return texture;
+  }
+
+  // Entries of freed textures, and of earlier versions of the file, would
+  // otherwise pile up as files are edited and reloaded
+  evictExpired();
+  Key oldest = key;
+  oldest.modificationTime = numeric_limits<time_t>::min();
+  for (TextureMap::iterator j = textureMap.lower_bound(oldest);
+       j != textureMap.end() && j->first.filename == ppmFileName && j->first.srgb == srgb; ) {
+    if (j->first.modificationTime < key.modificationTime)
+      textureMap.erase(j++);
+    else
+      ++j;
+  }
+
+  shared_ptr<ImageTexture> texture = async ? TextureLoader::getSingleton().load(ppmFileName, srgb)
+                                            : shared_ptr<ImageTexture>(new ImageTexture(ppmFileName.c_str(), srgb));
+  textureMap[key] = texture;
+  return texture;
+}
+
+int ImageTextureLibrary::evictExpired() {
+  int evicted = 0;
+  for (TextureMap::iterator i = textureMap.begin(); i != textureMap.end(); ) {
+    if (i->second.expired()) {
+      textureMap.erase(i++);
+      ++evicted;
+    }
+    else
+      ++i;
+  }
+  return evicted;
+}
+
+size_t ImageTextureLibrary::getMemoryUsage() const {
+  size_t bytes = 0;
+  for (TextureMap::const_iterator i = textureMap.begin(); i != textureMap.end(); ++i) {
+    if (shared_ptr<ImageTexture> texture = i->second.lock())
+      bytes += texture->getMemoryUsage();
+  }
+  return bytes;
+}
+
+void ImageTextureLibrary::reportMemory(ostream& os) const {
+  size_t total = 0;
+  int count = 0;
+  for (TextureMap::const_iterator i = textureMap.begin(); i != textureMap.end(); ++i) {
+    shared_ptr<ImageTexture> texture = i->second.lock();
+    if (!texture)
+      continue;
+
+    // one reference is held by the local above
+    os << i->first.filename << (i->first.srgb ? " (sRGB) " : " (linear) ")
+       << texture->getWidth() << "x" << texture->getHeight() << ": "
+       << texture->getMemoryUsage() << " bytes, "
+       << texture.use_count() - 1 << " users" << std::endl;
+    total += texture->getMemoryUsage();
+    ++count;
+  }
+  os << count << " textures, " << total << " bytes total" << std::endl;
 }
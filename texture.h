@@ -1,5 +1,11 @@
 #pragma once
 
+#include <map>
+#include <memory>
+#include <string>
+#include <ctime>
+#include <iostream>
+
 #include "glsupport.h"
 
 class Texture {
@@ -18,8 +24,20 @@ public:
 // One concrete implementation of Texture
 //----------------------------------------
 
+class MipChain;
+
 class ImageTexture : public Texture {
   GlTexture tex;
+  int width_, height_;
+  bool srgb_, ready_;
+
+  friend class TextureLoader;
+
+  // Creates a texture that binds a placeholder until upload() is called
+  explicit ImageTexture(bool srgb);
+
+  // 1x1 texture bound in place of textures that are not uploaded yet
+  static GLuint getPlaceholder(bool srgb);
 
 public:
   // Loades a PPM image files with three channels, and create
@@ -32,6 +50,89 @@ public:
   }
 
   virtual void bind() const {
-    glBindTexture(GL_TEXTURE_2D, tex);
+    GlStateCache::getSingleton().bindTexture(GL_TEXTURE_2D, ready_ ? (GLuint)tex : getPlaceholder(srgb_));
+  }
+
+  // false while a texture loaded by the TextureLoader is still in flight
+  bool isReady() const {
+    return ready_;
+  }
+
+  // Uploads all levels of `mips' and makes the texture ready. If `pixelBuffer'
+  // is not 0, the levels are read from that pixel buffer object instead of
+  // client memory, where MipChain::copyTo must have placed them already.
+  void upload(const MipChain& mips, GLuint pixelBuffer = 0);
+
+  int getWidth() const {
+    return width_;
+  }
+
+  int getHeight() const {
+    return height_;
   }
+
+  // Estimated GPU memory used by the texture and its mipmaps, in bytes
+  size_t getMemoryUsage() const;
+};
+
+//----------------------------------------------------------------------
+// Process-wide cache of ImageTextures, keyed by file name, color space
+// and modification time of the file, so that a PPM used by several
+// materials is decoded and uploaded only once.
+//
+// The library only keeps weak references: a texture is freed as soon as
+// the last material using it lets go of it, and its entry is evicted the
+// next time a texture is loaded. Loading a file that changed on disk also
+// evicts the entries of its older versions.
+//----------------------------------------------------------------------
+
+class ImageTextureLibrary {
+  struct Key {
+    std::string filename;
+    bool srgb;
+    std::time_t modificationTime;
+
+    bool operator<(const Key& k) const {
+      if (filename != k.filename)
+        return filename < k.filename;
+      if (srgb != k.srgb)
+        return srgb < k.srgb;
+      return modificationTime < k.modificationTime;
+    }
+  };
+
+  typedef std::map<Key, std::weak_ptr<ImageTexture> > TextureMap;
+
+  TextureMap textureMap;
+
+  ImageTextureLibrary() {}
+
+  std::shared_ptr<ImageTexture> getTexture(const std::string& ppmFileName, bool srgb, bool async);
+
+public:
+  static ImageTextureLibrary& getSingleton() {
+    static ImageTextureLibrary tl;
+    return tl;
+  }
+
+  // Returns the shared texture for the given file and color space, loading it
+  // if it is not cached yet or if the file has changed on disk since.
+  std::shared_ptr<ImageTexture> getTexture(const std::string& ppmFileName, bool srgb) {
+    return getTexture(ppmFileName, srgb, false);
+  }
+
+  // Same as getTexture, but a texture that is not cached yet is loaded in the
+  // background by the TextureLoader and binds a placeholder until it is ready
+  std::shared_ptr<ImageTexture> getTextureAsync(const std::string& ppmFileName, bool srgb) {
+    return getTexture(ppmFileName, srgb, true);
+  }
+
+  // Drops the entries whose texture has been freed. Returns the number of evicted entries
+  int evictExpired();
+
+  // Total estimated GPU memory of the live textures, in bytes
+  size_t getMemoryUsage() const;
+
+  // Prints one line per live texture with its size, memory and number of users
+  void reportMemory(std::ostream& os) const;
 };
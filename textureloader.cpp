@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+
+#include "mipcache.h"
+#include "textureloader.h"
+
+using namespace std;
+
+TextureLoader::TextureLoader()
+  : stopping_(false), numPending_(0) {
+  // Leave a core to the GL thread
+  const unsigned int numWorkers = max(1u, min(4u, thread::hardware_concurrency() - 1));
+  for (unsigned int i = 0; i < numWorkers; ++i)
+    workers_.push_back(thread(&TextureLoader::workerMain, this));
+}
+
+TextureLoader::~TextureLoader() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  workAvailable_.notify_all();
+  for (size_t i = 0; i < workers_.size(); ++i)
+    workers_[i].join();
+}
+
+shared_ptr<ImageTexture> TextureLoader::load(const string& ppmFileName, bool srgb) {
+  shared_ptr<ImageTexture> texture(new ImageTexture(srgb));
+
+  Job job;
+  job.texture = texture;
+  job.filename = ppmFileName;
+  job.srgb = srgb;
+  {
+    lock_guard<mutex> lock(mutex_);
+    queued_.push_back(job);
+    ++numPending_;
+  }
+  workAvailable_.notify_one();
+  return texture;
+}
+
+void TextureLoader::workerMain() {
+  for (;;) {
+    Job job;
+    {
+      unique_lock<mutex> lock(mutex_);
+      while (queued_.empty() && !stopping_)
+        workAvailable_.wait(lock);
+      if (stopping_)
+        return;
+      job = queued_.front();
+      queued_.pop_front();
+    }
+
+    // Mapped by the GL thread, which also unmaps it even if the texture is gone
+    if (job.mapping) {
+      job.mips->copyTo(job.mapping);
+      pushProcessed(staged_, job);
+      continue;
+    }
+
+    // Nobody wants this texture anymore
+    if (job.texture.expired()) {
+      lock_guard<mutex> lock(mutex_);
+      --numPending_;
+      continue;
+    }
+
+    try {
+      job.mips.reset(new MipChain());
+      loadMipChain(job.filename.c_str(), job.srgb, *job.mips);
+    }
+    catch (const exception& e) {
+      job.mips.reset();
+      job.error = e.what();
+    }
+    pushProcessed(decoded_, job);
+  }
+}
+
+void TextureLoader::pushProcessed(deque<Job>& queue, const Job& job) {
+  function<void()> decodedCallback;
+  {
+    lock_guard<mutex> lock(mutex_);
+    queue.push_back(job);
+    decodedCallback = decodedCallback_;
+  }
+  if (decodedCallback)
+    decodedCallback();
+}
+
+void TextureLoader::setDecodedCallback(const function<void()>& callback) {
+  lock_guard<mutex> lock(mutex_);
+  decodedCallback_ = callback;
+}
+
+bool TextureLoader::mapPixelBuffer(Job& job) {
+  if (freePixelBuffers_.empty())
+    freePixelBuffers_.push_back(shared_ptr<GlBufferObject>(new GlBufferObject()));
+  job.pixelBuffer = freePixelBuffers_.back();
+  freePixelBuffers_.pop_back();
+
+  // Orphan the previous contents so that mapping never waits for a
+  // transfer that is still in flight
+  const size_t size = job.mips->getSize();
+  GlStateCache& gl = GlStateCache::getSingleton();
+  gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, *job.pixelBuffer);
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+  job.mapping = static_cast<unsigned char*>(
+    glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+  gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  if (job.mapping == NULL) {
+    releasePixelBuffer(job);
+    return false;
+  }
+
+  {
+    lock_guard<mutex> lock(mutex_);
+    queued_.push_back(job);
+  }
+  workAvailable_.notify_one();
+  return true;
+}
+
+void TextureLoader::unmapPixelBuffer(Job& job) {
+  GlStateCache& gl = GlStateCache::getSingleton();
+  gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, *job.pixelBuffer);
+  glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+  gl.bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  job.mapping = NULL;
+}
+
+void TextureLoader::releasePixelBuffer(Job& job) {
+  freePixelBuffers_.push_back(job.pixelBuffer);
+  job.pixelBuffer.reset();
+}
+
+int TextureLoader::processUploads(size_t byteBudget) {
+  int numReady = 0;
+
+  // Upload the levels the workers copied into pixel buffers
+  for (size_t uploaded = 0; uploaded < byteBudget; ) {
+    Job job;
+    {
+      lock_guard<mutex> lock(mutex_);
+      if (staged_.empty())
+        break;
+      job = staged_.front();
+      staged_.pop_front();
+      --numPending_;
+    }
+
+    unmapPixelBuffer(job);
+    if (shared_ptr<ImageTexture> texture = job.texture.lock()) {
+      texture->upload(*job.mips, *job.pixelBuffer);
+      uploaded += job.mips->getSize();
+      ++numReady;
+    }
+    releasePixelBuffer(job);
+  }
+
+  // Map pixel buffers for the textures decoded since, for the workers to fill
+  for (size_t mapped = 0; mapped < byteBudget; ) {
+    Job job;
+    {
+      lock_guard<mutex> lock(mutex_);
+      if (decoded_.empty())
+        break;
+      job = decoded_.front();
+      decoded_.pop_front();
+    }
+
+    shared_ptr<ImageTexture> texture = job.texture.lock();
+    if (!texture || !job.mips) {
+      if (texture) {
+        // the texture keeps binding its placeholder
+        cerr << "WARN: cannot load texture " << job.filename << ": " << job.error << endl;
+      }
+      lock_guard<mutex> lock(mutex_);
+      --numPending_;
+      continue;
+    }
+
+    if (mapPixelBuffer(job)) {
+      mapped += job.mips->getSize();
+      continue;
+    }
+
+    // upload from client memory instead
+    {
+      lock_guard<mutex> lock(mutex_);
+      --numPending_;
+    }
+    texture->upload(*job.mips);
+    mapped += job.mips->getSize();
+    ++numReady;
+  }
+  return numReady;
+}
+
+int TextureLoader::getNumPending() const {
+  lock_guard<mutex> lock(mutex_);
+  return numPending_;
+}
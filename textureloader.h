@@ -0,0 +1,102 @@
+#pragma once
+
+#include <deque>
+#include <functional>
+#include <vector>
+#include <memory>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include "glsupport.h"
+#include "texture.h"
+
+class MipChain;
+
+//----------------------------------------------------------------------
+// Loads ImageTextures in the background.
+//
+// Decoding (PPM parsing, mip chain building, or reading the mip cache) runs
+// on worker threads. processUploads(), which should be called once per frame
+// on the GL thread, then maps a pixel buffer object for each decoded texture,
+// and a worker copies the levels into the mapping. A later processUploads()
+// only unmaps the buffer and issues glTexImage2D from it, so that the GL
+// thread neither touches the pixels nor waits for the transfer. Until then
+// the texture binds a 1x1 placeholder, so it can be used by materials right
+// away and shows up once it is ready.
+//----------------------------------------------------------------------
+
+class TextureLoader : Noncopyable {
+public:
+  static TextureLoader& getSingleton() {
+    static TextureLoader tl;
+    return tl;
+  }
+
+  // Returns a texture that binds a placeholder until its image is uploaded
+  std::shared_ptr<ImageTexture> load(const std::string& ppmFileName, bool srgb);
+
+  // Uploads the textures staged in pixel buffers, and maps pixel buffers for
+  // the newly decoded ones. Each of the two stops after the first texture that
+  // brings its amount of data above `byteBudget', so that a burst of finished
+  // textures is spread over several frames. Must be called on the GL thread.
+  // Returns the number of textures that became ready.
+  int processUploads(size_t byteBudget = 16 << 20);
+
+  // Number of textures that have been requested but are not uploaded yet
+  int getNumPending() const;
+
+  // Called on a worker thread whenever a texture is decoded or staged and waits
+  // for processUploads(), e.g., to wake up a GL thread blocked waiting for events
+  void setDecodedCallback(const std::function<void()>& callback);
+
+  ~TextureLoader();
+
+private:
+  struct Job {
+    std::weak_ptr<ImageTexture> texture;
+    std::string filename;
+    bool srgb;
+    std::shared_ptr<MipChain> mips;
+    std::string error;
+
+    // Set once the GL thread mapped a pixel buffer for the levels
+    std::shared_ptr<GlBufferObject> pixelBuffer;
+    unsigned char *mapping;
+
+    Job() : srgb(false), mapping(NULL) {}
+  };
+
+  std::vector<std::thread> workers_;
+
+  // Jobs to decode, or to copy into their mapping, then waiting to be mapped,
+  // then waiting to be uploaded from their pixel buffer
+  std::deque<Job> queued_, decoded_, staged_;
+  mutable std::mutex mutex_;
+  std::condition_variable workAvailable_;
+  std::function<void()> decodedCallback_;
+  bool stopping_;
+  int numPending_;
+
+  // Unmapped pixel buffers to reuse. Only used on the GL thread.
+  std::vector<std::shared_ptr<GlBufferObject> > freePixelBuffers_;
+
+  TextureLoader();
+
+  void workerMain();
+
+  // Notifies the GL thread that `job' is ready for processUploads()
+  void pushProcessed(std::deque<Job>& queue, const Job& job);
+
+  // Maps a pixel buffer of the size of the decoded levels of `job', and
+  // queues it for a worker to fill. Returns false if mapping fails.
+  bool mapPixelBuffer(Job& job);
+
+  // Unmaps the pixel buffer of `job'
+  void unmapPixelBuffer(Job& job);
+
+  // Puts the pixel buffer of `job' back for reuse. Mapping orphans the
+  // store, so this is safe right after glTexImage2D is issued from it.
+  void releasePixelBuffer(Job& job);
+};
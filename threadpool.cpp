@@ -0,0 +1,104 @@
+#include <algorithm>
+
+#include "threadpool.h"
+
+using namespace std;
+
+// Set on worker threads, and on a thread inside parallelFor, so that nested
+// calls run inline instead of waiting for themselves
+static thread_local bool t_insideParallelFor = false;
+
+ThreadPool::ThreadPool()
+  : stopping_(false), task_(NULL), numTasks_(0), generation_(0), nextTask_(0), numBusy_(0) {
+  const unsigned int numWorkers = max(1u, thread::hardware_concurrency()) - 1;
+  for (unsigned int i = 0; i < numWorkers; ++i)
+    workers_.push_back(thread(&ThreadPool::workerMain, this));
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  workAvailable_.notify_all();
+  for (size_t i = 0; i < workers_.size(); ++i)
+    workers_[i].join();
+}
+
+void ThreadPool::parallelFor(int numTasks, const function<void(int)>& task) {
+  if (numTasks <= 0)
+    return;
+
+  if (t_insideParallelFor || workers_.empty() || numTasks == 1) {
+    for (int i = 0; i < numTasks; ++i)
+      task(i);
+    return;
+  }
+
+  lock_guard<mutex> callLock(callMutex_);
+  {
+    lock_guard<mutex> lock(mutex_);
+    task_ = &task;
+    numTasks_ = numTasks;
+    nextTask_ = 0;
+    error_ = exception_ptr();
+    numBusy_ = workers_.size();
+    ++generation_;
+  }
+  workAvailable_.notify_all();
+
+  t_insideParallelFor = true;
+  runTasks(task, numTasks);
+  t_insideParallelFor = false;
+
+  exception_ptr error;
+  {
+    unique_lock<mutex> lock(mutex_);
+    while (numBusy_ > 0)
+      workDone_.wait(lock);
+    task_ = NULL;
+    error = error_;
+  }
+  if (error)
+    rethrow_exception(error);
+}
+
+void ThreadPool::runTasks(const function<void(int)>& task, int numTasks) {
+  for (int i = nextTask_++; i < numTasks; i = nextTask_++) {
+    try {
+      task(i);
+    }
+    catch (...) {
+      lock_guard<mutex> lock(mutex_);
+      if (!error_)
+        error_ = current_exception();
+    }
+  }
+}
+
+void ThreadPool::workerMain() {
+  t_insideParallelFor = true;
+  unsigned int lastGeneration = 0;
+  for (;;) {
+    const function<void(int)> *task;
+    int numTasks;
+    {
+      unique_lock<mutex> lock(mutex_);
+      while (generation_ == lastGeneration && !stopping_)
+        workAvailable_.wait(lock);
+      if (stopping_)
+        return;
+      lastGeneration = generation_;
+      task = task_;
+      numTasks = numTasks_;
+    }
+
+    runTasks(*task, numTasks);
+
+    {
+      lock_guard<mutex> lock(mutex_);
+      --numBusy_;
+    }
+    workDone_.notify_one();
+  }
+}
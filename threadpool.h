@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "glsupport.h"
+
+//----------------------------------------------------------------------
+// A pool of worker threads for data parallel CPU work, such as mesh import
+// and processing. parallelFor splits a range of tasks among the workers and
+// the calling thread, and returns when all tasks are done:
+//
+//   ThreadPool::getSingleton().parallelFor(numChunks, [&](int i) {
+//     process(chunks[i]);
+//   });
+//
+// The tasks must not touch GL. Calls from within a task run serially on the
+// calling worker, and concurrent calls from several threads are serialized.
+//----------------------------------------------------------------------
+
+class ThreadPool : Noncopyable {
+public:
+  static ThreadPool& getSingleton() {
+    static ThreadPool tp;
+    return tp;
+  }
+
+  // Number of threads running tasks, including the calling thread
+  int getNumThreads() const {
+    return workers_.size() + 1;
+  }
+
+  // Runs task(i) for i in [0, numTasks). Rethrows the first exception thrown
+  // by a task, after all tasks have finished.
+  void parallelFor(int numTasks, const std::function<void(int)>& task);
+
+  ~ThreadPool();
+
+private:
+  std::vector<std::thread> workers_;
+  std::mutex mutex_, callMutex_;
+  std::condition_variable workAvailable_, workDone_;
+  bool stopping_;
+
+  // The current parallelFor call; generation_ changes with every call so
+  // that workers pick up each one exactly once
+  const std::function<void(int)> *task_;
+  int numTasks_;
+  unsigned int generation_;
+  std::atomic<int> nextTask_;
+  int numBusy_;
+  std::exception_ptr error_;
+
+  ThreadPool();
+
+  void workerMain();
+
+  // Runs tasks of the current call until none are left
+  void runTasks(const std::function<void(int)>& task, int numTasks);
+};
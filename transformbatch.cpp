@@ -0,0 +1,85 @@
+#include <algorithm>
+
+#include "threadpool.h"
+#include "transformbatch.h"
+
+using namespace std;
+
+void TransformBatch::resize(int n) {
+  qw_.resize(n, 1.0f);
+  qx_.resize(n, 0.0f);
+  qy_.resize(n, 0.0f);
+  qz_.resize(n, 0.0f);
+  tx_.resize(n, 0.0f);
+  ty_.resize(n, 0.0f);
+  tz_.resize(n, 0.0f);
+  modelViewMatrices_.resize(n);
+  normalMatrices_.resize(n);
+}
+
+void TransformBatch::compute(const Rbt& invEyeRbt) {
+  const int n = size();
+  ThreadPool& pool = ThreadPool::getSingleton();
+  if (n < MIN_PARALLEL_SIZE || pool.getNumThreads() == 1) {
+    computeRange(invEyeRbt, 0, n);
+    return;
+  }
+
+  const int numRanges = min(n / (MIN_PARALLEL_SIZE / 4), pool.getNumThreads() * 4);
+  pool.parallelFor(numRanges, [&](int r) {
+    computeRange(invEyeRbt, int((long long)n * r / numRanges), int((long long)n * (r + 1) / numRanges));
+  });
+}
+
+void TransformBatch::computeRange(const Rbt& invEyeRbt, int begin, int end) {
+  if (begin >= end)
+    return;
+
+  // The eye rotation as a quaternion, to compose with the frame rotations,
+  // and as a matrix, to rotate the frame translations
+  const float ew = invEyeRbt.r.w, ex = invEyeRbt.r.x, ey = invEyeRbt.r.y, ez = invEyeRbt.r.z;
+  const glm::mat3 e = glm::mat3_cast(invEyeRbt.r);
+  const glm::vec3 et = invEyeRbt.t;
+
+  const float *qw = &qw_[0], *qx = &qx_[0], *qy = &qy_[0], *qz = &qz_[0];
+  const float *tx = &tx_[0], *ty = &ty_[0], *tz = &tz_[0];
+  float *mv = glm::value_ptr(modelViewMatrices_[0]);
+  float *nm = glm::value_ptr(normalMatrices_[0]);
+
+  for (int i = begin; i < end; ++i) {
+    // rotation of invEyeRbt * rbt
+    const float w = ew * qw[i] - ex * qx[i] - ey * qy[i] - ez * qz[i];
+    const float x = ew * qx[i] + ex * qw[i] + ey * qz[i] - ez * qy[i];
+    const float y = ew * qy[i] - ex * qz[i] + ey * qw[i] + ez * qx[i];
+    const float z = ew * qz[i] + ex * qy[i] - ey * qx[i] + ez * qw[i];
+
+    // translation of invEyeRbt * rbt
+    const float px = e[0][0] * tx[i] + e[1][0] * ty[i] + e[2][0] * tz[i] + et.x;
+    const float py = e[0][1] * tx[i] + e[1][1] * ty[i] + e[2][1] * tz[i] + et.y;
+    const float pz = e[0][2] * tx[i] + e[1][2] * ty[i] + e[2][2] * tz[i] + et.z;
+
+    // rotation matrix of the unit quaternion, column major like glm::mat4_cast
+    const float xx = x * x, yy = y * y, zz = z * z;
+    const float xy = x * y, xz = x * z, yz = y * z;
+    const float wx = w * x, wy = w * y, wz = w * z;
+    const float r[9] = {
+      1 - 2 * (yy + zz), 2 * (xy + wz), 2 * (xz - wy),
+      2 * (xy - wz), 1 - 2 * (xx + zz), 2 * (yz + wx),
+      2 * (xz + wy), 2 * (yz - wx), 1 - 2 * (xx + yy)
+    };
+
+    float *m = mv + 16 * i, *nmi = nm + 16 * i;
+    for (int c = 0; c < 3; ++c) {
+      m[4 * c] = nmi[4 * c] = r[3 * c];
+      m[4 * c + 1] = nmi[4 * c + 1] = r[3 * c + 1];
+      m[4 * c + 2] = nmi[4 * c + 2] = r[3 * c + 2];
+      m[4 * c + 3] = nmi[4 * c + 3] = 0;
+    }
+    m[12] = px;
+    m[13] = py;
+    m[14] = pz;
+    m[15] = 1;
+    nmi[12] = nmi[13] = nmi[14] = 0;
+    nmi[15] = 1;
+  }
+}
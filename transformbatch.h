@@ -0,0 +1,56 @@
+#pragma once
+
+#include <vector>
+
+#include "glmutils.h"
+
+// Model view and normal matrices of many rigid frames, computed in one pass.
+//
+// The frames are stored as structure of arrays, one array per quaternion and
+// translation component, so that compute() runs a single loop the compiler
+// can vectorize, split across the thread pool when there are many frames.
+// Draws then only read the resulting contiguous matrices:
+//
+//   batch.resize(numObjects);
+//   batch.setRbt(i, objectRbt[i]);   // for every object, every frame
+//   batch.compute(invEyeRbt);
+//   uniforms.put("uModelViewMatrix", batch.getModelViewMatrix(i));
+class TransformBatch {
+public:
+  void resize(int n);
+
+  int size() const {
+    return qw_.size();
+  }
+
+  void setRbt(int i, const Rbt& rbt) {
+    qw_[i] = rbt.r.w;
+    qx_[i] = rbt.r.x;
+    qy_[i] = rbt.r.y;
+    qz_[i] = rbt.r.z;
+    tx_[i] = rbt.t.x;
+    ty_[i] = rbt.t.y;
+    tz_[i] = rbt.t.z;
+  }
+
+  // Computes invEyeRbt * rbt as a matrix, and its rotation as the normal
+  // matrix, for every frame
+  void compute(const Rbt& invEyeRbt);
+
+  const glm::mat4& getModelViewMatrix(int i) const {
+    return modelViewMatrices_[i];
+  }
+
+  const glm::mat4& getNormalMatrix(int i) const {
+    return normalMatrices_[i];
+  }
+
+private:
+  // Below this many frames, threads cost more than they save
+  static const int MIN_PARALLEL_SIZE = 16384;
+
+  std::vector<float> qw_, qx_, qy_, qz_, tx_, ty_, tz_;
+  std::vector<glm::mat4> modelViewMatrices_, normalMatrices_;
+
+  void computeRange(const Rbt& invEyeRbt, int begin, int end);
+};
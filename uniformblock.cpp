@@ -0,0 +1,127 @@
+#include <cassert>
+#include <cstring>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+
+#include "geometry.h"
+#include "uniformblock.h"
+
+using namespace std;
+
+typedef map<string, shared_ptr<const UniformBlockLayout> > LayoutMap;
+typedef map<string, GLuint> BindingPointMap;
+
+static LayoutMap& getLayoutMap() {
+  static LayoutMap m;
+  return m;
+}
+
+static BindingPointMap& getBindingPointMap() {
+  static BindingPointMap m;
+  return m;
+}
+
+GLuint UniformBlock::getBindingPoint(const string& blockName) {
+  BindingPointMap& m = getBindingPointMap();
+  BindingPointMap::iterator i = m.find(blockName);
+  if (i != m.end())
+    return i->second;
+
+  static GLint maxBindings = 0;
+  if (maxBindings == 0)
+    glGetIntegerv(GL_MAX_UNIFORM_BUFFER_BINDINGS, &maxBindings);
+
+  const GLuint point = m.size();
+  if ((GLint)point >= maxBindings) {
+    stringstream s;
+    s << "Uniform block " << blockName << ": system allows a maximum of " << maxBindings << " uniform buffer bindings.";
+    throw runtime_error(s.str());
+  }
+  m[blockName] = point;
+  return point;
+}
+
+void UniformBlock::registerLayout(const shared_ptr<const UniformBlockLayout>& layout) {
+  LayoutMap& m = getLayoutMap();
+  if (m.find(layout->name) == m.end())
+    m[layout->name] = layout;
+}
+
+shared_ptr<const UniformBlockLayout> UniformBlock::getLayout(const string& blockName) {
+  LayoutMap& m = getLayoutMap();
+  LayoutMap::iterator i = m.find(blockName);
+  return i == m.end() ? shared_ptr<const UniformBlockLayout>() : i->second;
+}
+
+UniformBlock::UniformBlock(const string& blockName, bool streamed)
+  : name_(blockName), bindingPoint_(getBindingPoint(blockName)), dirty_(true), bufferSize_(0),
+    ring_(streamed ? new BufferRing() : NULL), ringOffset_(0) {}
+
+UniformBlock::~UniformBlock() {}
+
+void UniformBlock::bind() {
+  if (dirty_) {
+    shared_ptr<const UniformBlockLayout> layout = getLayout(name_);
+    if (!layout)
+      return;   // the programs declaring the block are still linking
+    upload(*layout, values_);
+    dirty_ = false;
+  }
+  if (ring_)
+    GlStateCache::getSingleton().bindBufferRange(GL_UNIFORM_BUFFER, bindingPoint_, ubo_, ringOffset_, data_.size());
+  else
+    GlStateCache::getSingleton().bindBufferBase(GL_UNIFORM_BUFFER, bindingPoint_, ubo_);
+}
+
+void UniformBlock::update(const UniformBlockLayout& layout, const Uniforms& uniforms) {
+  upload(layout, uniforms);
+  dirty_ = false;
+}
+
+void UniformBlock::upload(const UniformBlockLayout& layout, const Uniforms& uniforms) {
+  data_.assign(layout.dataSize, 0);
+
+  for (size_t i = 0; i < layout.members.size(); ++i) {
+    const UniformBlockLayout::Member& m = layout.members[i];
+
+    const Uniforms::Value* u = uniforms.get(m.id);
+    if (u == NULL && m.arrayId >= 0)
+      u = uniforms.get(m.arrayId);
+
+    if (u == NULL)
+      throw runtime_error("Uniform variable " + m.name + " in block " + layout.name + ": used in the shader codes, but not supplied.");
+    if (u->type != m.type || u->size < m.size)
+      throw runtime_error("Uniform variable " + m.name + " in block " + layout.name + ": supplied value and declared variable do not match in type and/or size.");
+
+    // Scatter each element, and each column of matrices, at the std140 strides
+    const GLint *src = u->offset < 0 ? u->data.i : &uniforms.heap_[u->offset];
+    const int components = _helper::getTypeComponents(m.type);
+    const int columns = m.type == GL_FLOAT_MAT4 ? 4 : 1;
+    const int rows = components / columns;
+    for (int e = 0; e < m.size; ++e) {
+      for (int c = 0; c < columns; ++c) {
+        const size_t offset = m.offset + e * m.arrayStride + c * m.matrixStride;
+        assert(offset + rows * sizeof(GLint) <= data_.size());
+        memcpy(&data_[offset], src, rows * sizeof(GLint));
+        src += rows;
+      }
+    }
+  }
+
+  // The store is allocated once, then updated in place, or slot by slot if streamed
+  GlStateCache::getSingleton().bindBuffer(GL_UNIFORM_BUFFER, ubo_);
+  if (ring_) {
+    static GLint alignment = 0;
+    if (alignment == 0)
+      glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    const size_t slotSize = (data_.size() + alignment - 1) / alignment * alignment;
+    ringOffset_ = ring_->write(GL_UNIFORM_BUFFER, &data_[0], data_.size(), slotSize) * slotSize;
+  }
+  else if (bufferSize_ != data_.size()) {
+    glBufferData(GL_UNIFORM_BUFFER, data_.size(), &data_[0], GL_DYNAMIC_DRAW);
+    bufferSize_ = data_.size();
+  }
+  else
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, data_.size(), &data_[0]);
+}
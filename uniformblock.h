@@ -0,0 +1,115 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "glsupport.h"
+#include "uniforms.h"
+
+class BufferRing;
+
+// Layout of a std140 uniform block, as reflected from the first program that
+// declares a block of that name. std140 guarantees the same layout in every
+// program declaring the block identically.
+struct UniformBlockLayout {
+  struct Member {
+    std::string name;
+    int id, arrayId;    // interned names, see GlProgramDesc::UniformDesc
+    GLenum type;
+    GLint size;
+    GLint offset, arrayStride, matrixStride;
+  };
+
+  std::string name;
+  GLint dataSize;
+  std::vector<Member> members;
+};
+
+// A std140 uniform block backed by a uniform buffer object.
+//
+// Values are set with the same put calls as Uniforms, are packed into a CPU
+// image of the block, and are uploaded in one go by bind(), only if they
+// changed. bind() then attaches the buffer to the binding point reserved for
+// the block name, where every program declaring the block will read it. E.g.,
+// a per-frame block is filled and bound once per frame:
+//
+//   frameBlock.put("uProjMatrix", proj).put("uLight", light);
+//   frameBlock.bind();
+//
+// Blocks rewritten every frame, like the per-frame block, should be created
+// `streamed': each upload then goes to the next slot of a BufferRing and
+// never waits for the draws of the previous frames to stop reading the buffer.
+//
+// The layout is known once the program of some Material declaring the block
+// is finished (see Material::pollPrograms()). Until then no draw can read the
+// block, and bind() does nothing.
+class UniformBlock : Noncopyable {
+public:
+  explicit UniformBlock(const std::string& blockName, bool streamed = false);
+  ~UniformBlock();
+
+  template<typename T>
+  UniformBlock& put(const UniformName& name, const T& value) {
+    values_.put(name, value);
+    dirty_ = true;
+    return *this;
+  }
+
+  template<typename T>
+  UniformBlock& put(const UniformName& name, const T *values, int count) {
+    values_.put(name, values, count);
+    dirty_ = true;
+    return *this;
+  }
+
+  template<typename T>
+  UniformBlock& put(const std::string& name, const T& value) {
+    return put(UniformName(name), value);
+  }
+
+  template<typename T>
+  UniformBlock& put(const std::string& name, const T *values, int count) {
+    return put(UniformName(name), values, count);
+  }
+
+  // Uploads the values if they changed since the last call, and binds the
+  // buffer. Does nothing while the layout is not known yet.
+  void bind();
+
+  // Uploads the values in `uniforms', which may hold more uniforms than the
+  // block declares, using the given layout instead of the registered one. Used
+  // by Material for its own block, whose contents vary from program to program.
+  void update(const UniformBlockLayout& layout, const Uniforms& uniforms);
+
+  const std::string& getName() const {
+    return name_;
+  }
+
+  // The binding point of the named block, reserved on first request and shared
+  // by all programs declaring a block of that name
+  static GLuint getBindingPoint(const std::string& blockName);
+
+  // Records the layout of a block, if it is the first time one of that name is seen
+  static void registerLayout(const std::shared_ptr<const UniformBlockLayout>& layout);
+
+  // NULL if no program declaring the block has been linked yet
+  static std::shared_ptr<const UniformBlockLayout> getLayout(const std::string& blockName);
+
+protected:
+  std::string name_;
+  GLuint bindingPoint_;
+  Uniforms values_;
+  bool dirty_;
+
+  std::vector<unsigned char> data_;
+  GlBufferObject ubo_;
+  size_t bufferSize_;   // of the store of ubo_, 0 until allocated
+
+  // For streamed blocks, and the offset of the slot last written
+  std::unique_ptr<BufferRing> ring_;
+  size_t ringOffset_;
+
+  // Packs `uniforms' into data_ and uploads it to ubo_
+  void upload(const UniformBlockLayout& layout, const Uniforms& uniforms);
+};
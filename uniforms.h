@@ -1,58 +1,24 @@
 #pragma once
 
-#include <map>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <new>
 #include <vector>
 #include <memory>
 #include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <unordered_map>
 
 #include <glm/glm.hpp>
 #include "glsupport.h"
 #include "texture.h"
+#include "hash.h"
 
 // Private namespace for some helper functions. You should ignore this unless you
 // are interested in the internal implementation.
 namespace _helper {
-inline void genericGlUniformi(GLint location, int i) {
-  ::glUniform1i(location, i);
-}
-inline void genericGlUniformf(GLint location, float f) {
-  ::glUniform1f(location, f);
-}
-inline void genericGlUniformv(GLint location, int size, const GLint *v) {
-  ::glUniform1iv(location, size, v);
-}
-inline void genericGlUniformv(GLint location, int size, const GLfloat *v) {
-  ::glUniform1fv(location, size, v);
-}
-inline void genericGlUniformv(GLint location, int size, const glm::ivec1 *v) {
-  ::glUniform1iv(location, size, &v[0][0]);
-}
-inline void genericGlUniformv(GLint location, int size, const glm::ivec2 *v) {
-  ::glUniform2iv(location, size, &v[0][0]);
-}
-inline void genericGlUniformv(GLint location, int size, const glm::ivec3 *v) {
-  ::glUniform3iv(location, size, &v[0][0]);
-}
-inline void genericGlUniformv(GLint location, int size, const glm::ivec4 *v) {
-  ::glUniform4iv(location, size, &v[0][0]);
-}
-inline void genericGlUniformv(GLint location, int size, const glm::vec1 *v) {
-  ::glUniform1fv(location, size, &v[0][0]);
-}
-inline void genericGlUniformv(GLint location, int size, const glm::vec2 *v) {
-  ::glUniform2fv(location, size, &v[0][0]);
-}
-inline void genericGlUniformv(GLint location, int size, const glm::vec3 *v) {
-  ::glUniform3fv(location, size, &v[0][0]);
-}
-inline void genericGlUniformv(GLint location, int size, const glm::vec4 *v) {
-  ::glUniform4fv(location, size, &v[0][0]);                     // or glm::value_ptr(v[0])
-}
-inline void genericGlUniformMatrix4v(GLint location, int size, const glm::mat4 *m) {
-  ::glUniformMatrix4fv(location, size, GL_FALSE, &m[0][0][0]);   // or glm::value_ptr(m[0])
-}
-
 template<typename T, int n>
 inline GLenum getTypeForCvec();   // should replace with STATIC_ASSERT
 
@@ -80,9 +46,153 @@ template<>
 inline GLenum getTypeForCvec<bool, 3>() { return GL_BOOL_VEC3; }
 template<>
 inline GLenum getTypeForCvec<bool, 4>() { return GL_BOOL_VEC4; }
+
+inline bool isSamplerType(GLenum type) {
+  switch (type) {
+  case GL_SAMPLER_1D:
+  case GL_SAMPLER_2D:
+  case GL_SAMPLER_3D:
+  case GL_SAMPLER_CUBE:
+  case GL_SAMPLER_1D_SHADOW:
+  case GL_SAMPLER_2D_SHADOW:
+    return true;
+  default:
+    return false;
+  }
+}
+
+// Number of 4-byte scalars in one element of the given uniform type
+inline int getTypeComponents(GLenum type) {
+  switch (type) {
+  case GL_INT_VEC2:
+  case GL_FLOAT_VEC2:
+    return 2;
+  case GL_INT_VEC3:
+  case GL_FLOAT_VEC3:
+    return 3;
+  case GL_INT_VEC4:
+  case GL_FLOAT_VEC4:
+    return 4;
+  case GL_FLOAT_MAT4:
+    return 16;
+  default:
+    return 1;
+  }
+}
+
+// A vector of trivially copyable elements that keeps its first N elements
+// inline, so that it does not touch the heap as long as it stays small.
+template<typename T, int N>
+class SmallPodVector {
+  static_assert(std::is_trivially_copyable<T>::value, "SmallPodVector only holds trivially copyable types");
+
+  T* data_;
+  int size_, capacity_;
+  T inline_[N];
+
+public:
+  SmallPodVector() : data_(inline_), size_(0), capacity_(N) {}
+
+  SmallPodVector(const SmallPodVector& v) : data_(inline_), size_(0), capacity_(N) {
+    *this = v;
+  }
+
+  ~SmallPodVector() {
+    if (data_ != inline_)
+      std::free(data_);
+  }
+
+  SmallPodVector& operator= (const SmallPodVector& v) {
+    if (this != &v) {
+      reserve(v.size_);
+      if (v.size_ > 0)
+        std::memcpy(data_, v.data_, sizeof(T) * v.size_);
+      size_ = v.size_;
+    }
+    return *this;
+  }
+
+  int size() const { return size_; }
+  T* begin() { return data_; }
+  T* end() { return data_ + size_; }
+  const T* begin() const { return data_; }
+  const T* end() const { return data_ + size_; }
+  T& operator[] (int i) { return data_[i]; }
+  const T& operator[] (int i) const { return data_[i]; }
+
+  void reserve(int capacity) {
+    if (capacity <= capacity_)
+      return;
+    T* p = static_cast<T*>(std::malloc(sizeof(T) * capacity));
+    if (p == NULL)
+      throw std::bad_alloc();
+    if (size_ > 0)
+      std::memcpy(p, data_, sizeof(T) * size_);
+    if (data_ != inline_)
+      std::free(data_);
+    data_ = p;
+    capacity_ = capacity;
+  }
+
+  // Inserts an uninitialized element at position i and returns it
+  T& insert(int i) {
+    if (size_ == capacity_)
+      reserve(capacity_ * 2);
+    std::memmove(data_ + i + 1, data_ + i, sizeof(T) * (size_ - i));
+    ++size_;
+    return data_[i];
+  }
+};
 }
 
-// The Uniforms keeps a map from strings to values
+// An interned uniform name. Creating one looks the name up in a process-wide
+// table once; afterwards it is just an integer, and Uniforms can be set and
+// queried with it without any string handling. Best kept in a static, e.g.
+//
+//   static const UniformName uColor("uColor");
+//   uniforms.put(uColor, glm::vec3(1, 0, 0));
+//
+// The table is not thread safe: names must be created on the rendering thread.
+class UniformName {
+  int id_;
+
+  static std::unordered_map<std::string, int>& getIdMap() {
+    static std::unordered_map<std::string, int> m;
+    return m;
+  }
+
+  static std::vector<std::string>& getNames() {
+    static std::vector<std::string> v;
+    return v;
+  }
+
+public:
+  explicit UniformName(const std::string& name) {
+    std::unordered_map<std::string, int>::iterator i = getIdMap().find(name);
+    if (i == getIdMap().end()) {
+      id_ = (int)getNames().size();
+      getIdMap()[name] = id_;
+      getNames().push_back(name);
+    }
+    else
+      id_ = i->second;
+  }
+
+  int getId() const {
+    return id_;
+  }
+
+  const std::string& getString() const {
+    return getNames()[id_];
+  }
+
+  // The name interned under `id'
+  static const std::string& getString(int id) {
+    return getNames()[id];
+  }
+};
+
+// The Uniforms keeps a map from names to values
 //
 // Currently the value can be of the following type:
 // - Single int, float, or glm::mat4
@@ -93,91 +203,118 @@ inline GLenum getTypeForCvec<bool, 4>() { return GL_BOOL_VEC4; }
 // You either use uniform.put("varName", val) or
 // uniform.put("varArrayName", vals, numVals);
 //
+// Names can also be given as UniformName, which skips the name lookup.
+// Values are kept in a flat array sorted by name id. Single values of up to
+// 16 scalars (so up to a mat4) are stored inline in that array, which itself
+// keeps its first few entries inline. Overwriting an existing uniform, or
+// filling a fresh Uniforms with a handful of matrices and vectors each frame,
+// hence does not allocate.
+//
 // A Uniforms instance will start off empty, and you can use
 // its put member function to populate it.
 
 class Uniforms {
 public:
-  Uniforms& put(const std::string& name, int value) {
-    glm::ivec1 v(value);
-    valueMap[name].reset(new CvecsValue<int, 1>(&v, 1));
-    return *this;
+  Uniforms() : layoutHash_(0), layoutDirty_(true), changeCount_(0) {}
+
+  Uniforms& put(const UniformName& name, int value) {
+    return putScalars(name.getId(), GL_INT, 1, &value, sizeof(value));
   }
 
-  Uniforms& put(const std::string& name, float value) {
-    glm::vec1 v(value);
-    valueMap[name].reset(new CvecsValue<float, 1>(&v, 1));
-    return *this;
+  Uniforms& put(const UniformName& name, float value) {
+    return putScalars(name.getId(), GL_FLOAT, 1, &value, sizeof(value));
   }
 
-  Uniforms& put(const std::string& name, const glm::mat4& value) {
-    valueMap[name].reset(new Matrix4sValue(&value, 1));
-    return *this;
+  Uniforms& put(const UniformName& name, const glm::mat4& value) {
+    return putScalars(name.getId(), GL_FLOAT_MAT4, 1, &value[0][0], sizeof(value));
   }
 
-  Uniforms& put(const std::string& name, const std::shared_ptr<Texture>& value) {
-    valueMap[name].reset(new TexturesValue(&value, 1));
-    return *this;
+  Uniforms& put(const UniformName& name, const std::shared_ptr<Texture>& value) {
+    return putTextures(name.getId(), &value, 1);
   }
 
   template<int n>
-  Uniforms& put(const std::string& name, const glm::vec<n, int>& v) {    // , glm::defaultp
-    valueMap[name].reset(new CvecsValue<int, n>(&v, 1));
-    return *this;
+  Uniforms& put(const UniformName& name, const glm::vec<n, int>& v) {    // , glm::defaultp
+    return putScalars(name.getId(), _helper::getTypeForCvec<int, n>(), 1, &v[0], sizeof(int) * n);
   }
 
   template<int n>
-  Uniforms& put(const std::string& name, const glm::vec<n, float>& v) {
-    valueMap[name].reset(new CvecsValue<float, n>(&v, 1));
-    return *this;
+  Uniforms& put(const UniformName& name, const glm::vec<n, float>& v) {
+    return putScalars(name.getId(), _helper::getTypeForCvec<float, n>(), 1, &v[0], sizeof(float) * n);
   }
 
   template<int n>
-  Uniforms& put(const std::string& name, const glm::vec<n, double>& v) {
+  Uniforms& put(const UniformName& name, const glm::vec<n, double>& v) {
     glm::vec<n, float> u;
     for (int i = 0; i < n; ++i) {
       u[i] = float(v[i]);
     }
-    valueMap[name].reset(new CvecsValue<float, n>(&u, 1));
-    return *this;
+    return put(name, u);
   }
 
-  Uniforms& put(const std::string& name, const int *values, int count) {
-    valueMap[name].reset(new CvecsValue<int, 1>(reinterpret_cast<const glm::ivec1*>(values), count));
-    return *this;
+  Uniforms& put(const UniformName& name, const int *values, int count) {
+    return putScalars(name.getId(), GL_INT, count, values, sizeof(int) * count);
   }
 
-  Uniforms& put(const std::string& name, const float *values, int count) {
-    valueMap[name].reset(new CvecsValue<float, 1>(reinterpret_cast<const glm::vec1*>(values), count));
-    return *this;
+  Uniforms& put(const UniformName& name, const float *values, int count) {
+    return putScalars(name.getId(), GL_FLOAT, count, values, sizeof(float) * count);
   }
 
-  Uniforms& put(const std::string& name, const glm::mat4 *values, int count) {
-    valueMap[name].reset(new Matrix4sValue(values, count));
-    return *this;
+  Uniforms& put(const UniformName& name, const glm::mat4 *values, int count) {
+    return putScalars(name.getId(), GL_FLOAT_MAT4, count, &values[0][0][0], sizeof(glm::mat4) * count);
   }
 
-  Uniforms& put(const std::string& name, const std::shared_ptr<Texture> *values, int count) {
-    valueMap[name].reset(new TexturesValue(values, count));
-    return *this;
+  Uniforms& put(const UniformName& name, const std::shared_ptr<Texture> *values, int count) {
+    return putTextures(name.getId(), values, count);
   }
 
   template<int n>
-  Uniforms& put(const std::string& name, const glm::vec<n, int> *v, int count) {
-    valueMap[name].reset(new CvecsValue<int, n>(v, count));
-    return *this;
+  Uniforms& put(const UniformName& name, const glm::vec<n, int> *v, int count) {
+    return putScalars(name.getId(), _helper::getTypeForCvec<int, n>(), count, &v[0][0], sizeof(int) * n * count);
   }
 
   template<int n>
-  Uniforms& put(const std::string& name, const glm::vec<n, float> *v, int count) {
-    valueMap[name].reset(new CvecsValue<float, n>(v, count));
-    return *this;
+  Uniforms& put(const UniformName& name, const glm::vec<n, float> *v, int count) {
+    return putScalars(name.getId(), _helper::getTypeForCvec<float, n>(), count, &v[0][0], sizeof(float) * n * count);
   }
 
   template<int n>
-  Uniforms& put(const std::string& name, const glm::vec<n, double> *v, int count) {
-    valueMap[name].reset(new CvecsValue<float, n>(v, count));
-    return *this;
+  Uniforms& put(const UniformName& name, const glm::vec<n, double> *v, int count) {
+    std::vector<glm::vec<n, float> > u(count);
+    for (int i = 0; i < count; ++i) {
+      for (int d = 0; d < n; ++d) {
+        u[i][d] = float(v[i][d]);
+      }
+    }
+    return put(name, &u[0], count);
+  }
+
+  // Same as above, with the name given as a string
+  template<typename T>
+  Uniforms& put(const std::string& name, const T& value) {
+    return put(UniformName(name), value);
+  }
+
+  template<typename T>
+  Uniforms& put(const std::string& name, const T *values, int count) {
+    return put(UniformName(name), values, count);
+  }
+
+  // Hash of the names, types and sizes of all values, but not the values
+  // themselves. Two Uniforms with the same layout hash hold the same set of
+  // uniforms at the same internal positions. Only recomputed after a uniform
+  // is added or changes type or size.
+  uint64_t getLayoutHash() const {
+    if (layoutDirty_) {
+      uint64_t h = fnv1aHash(NULL, 0);
+      for (const Value *v = values_.begin(); v != values_.end(); ++v) {
+        const int key[3] = { v->id, (int)v->type, v->size };
+        h = fnv1aHash(key, sizeof(key), h);
+      }
+      layoutHash_ = h;
+      layoutDirty_ = false;
+    }
+    return layoutHash_;
   }
 
   // Future work: add put for different sized matrices, and array of basic types
@@ -186,151 +323,160 @@ protected:
   // Ghastly implementation details follow. Viewer be warned.
 
   friend class Material;
-  class ValueHolder;
-  class Value;
+  friend class UniformBlock;
 
-  typedef std::map<std::string, ValueHolder> ValueMap;
+  // One uniform. Kept trivially copyable so that the array of values can be
+  // moved around with memcpy.
+  struct Value {
+    // One of the uniform type as returned by glGetActiveUniform, used for matching
+    GLenum type;
 
-  ValueMap valueMap;
+    // 1 for non-array type, otherwise the number of elements in the array
+    GLint size;
 
-  const Value* get(const std::string& name) const {
-    std::map<std::string, ValueHolder>::const_iterator i = valueMap.find(name);
-    return i == valueMap.end() ? NULL : i->second.get();
-  }
+    // Interned name
+    int id;
 
-  class ValueHolder {
-    Value *value_;
+    // -1 if the data is stored in `data' below. Otherwise the index of the
+    // first element in `textures_' for samplers, or in `heap_' for the rest
+    int offset;
 
-public:
-    ValueHolder() : value_(NULL) {}
-    ValueHolder(Value* value) : value_(value) {}
-    ValueHolder(const ValueHolder& u) : value_(u.value_ ? u.value_->clone() : NULL) {}
-    ~ValueHolder() {
-      if (value_)
-        delete value_;
-    }
-    void reset(Value* value) {
-      if (value_)
-        delete value_;
-      value_ = value;
-    }
-
-    Value *get() const {
-      return value_;
-    }
-
-    ValueHolder& operator= (const ValueHolder& u) {
-      reset(u.value_ ? u.value_->clone() : NULL);
-      return *this;
-    }
+    union {
+      GLint i[16];
+      GLfloat f[16];
+    } data;
   };
 
+  _helper::SmallPodVector<Value, 8> values_;
 
-  class Value {
-public:
-    // One of the uniform type as returned by glGetActiveUniform, used for matching
-    const GLenum type;
-
-    // 1 for non-array type, otherwise the number of elements in the array
-    const GLint size;
-
-    virtual Value* clone() const = 0;
-    virtual ~Value() {}
-
-    // If type is one of GL_SAMPLER_*, the getTextures should provide a pointer to
-    // the array of shared_ptr<Texture> stored by the uniform. And apply should
-    // use the boundTexUnits argument as the argument for glUniform*.
-    //
-    // Otherwise, boundTexUnit should be ignored and whatever values contained in
-    // the Value instance should be set to given location.
-    //
-    // `count' specifies how many actural uniforms are specified by the shader, and
-    // should be used as input parameter to glUniform*
-    virtual void apply(GLint location, GLsizei count, const GLint *boundTexUnits) const = 0;
-    virtual const std::shared_ptr<Texture> * getTextures() const { return NULL; };
+  // Storage for arrays that do not fit in Value::data, and for textures
+  std::vector<GLint> heap_;
+  std::vector<std::shared_ptr<Texture> > textures_;
 
-protected:
-    Value(GLenum aType, GLint aSize) : type(aType), size(aSize) {}
-  };
+  mutable uint64_t layoutHash_;
+  mutable bool layoutDirty_;
 
-  template<typename T, int n>
-  class CvecsValue : public Value {
-    std::vector<glm::vec<n, T, glm::defaultp> > vs_;    // std::vector<Cvec<T, n> > vs_;
+  // Bumped by every put, so that copies of the values can tell when they are stale
+  unsigned int changeCount_;
 
-public:
-    CvecsValue(const glm::vec<n, T, glm::defaultp> *vs, int size)
-      : Value(_helper::getTypeForCvec<T,n>(), size), vs_(vs, vs + size) {
-      assert(size > 0);
+  // Branch-free binary search for the value with the given id. Returns NULL if not found
+  const Value* get(int id) const {
+    const Value* base = values_.begin();
+    int n = values_.size();
+    if (n == 0)
+      return NULL;
+    while (n > 1) {
+      const int half = n / 2;
+      base = base[half].id <= id ? base + half : base;
+      n -= half;
     }
+    return base->id == id ? base : NULL;
+  }
 
-    // construct from Cvecs of another type
-    template<typename S>
-    CvecsValue(const glm::vec<n, S, glm::defaultp>  *vs, int size)
-      : Value(_helper::getTypeForCvec<T,n>(), size), vs_(size) {
-      assert(size > 0);
-      for (int i = 0; i < size; ++i) {
-        for (int d = 0; d < n; ++d) {
-          vs_[i][d] = T(vs[i][d]);
-        }
-      }
-    }
+  const Value* get(const UniformName& name) const {
+    return get(name.getId());
+  }
 
-    virtual Value* clone() const {
-      return new CvecsValue(*this);
-    }
+  // Returns the value with the given id, inserting an empty one if needed
+  Value& getOrInsert(int id) {
+    Value* v = const_cast<Value*>(get(id));
+    if (v)
+      return *v;
+
+    int i = 0;
+    while (i < values_.size() && values_[i].id < id)
+      ++i;
+    Value& nv = values_.insert(i);
+    nv.type = GL_NONE;
+    nv.size = 0;
+    nv.id = id;
+    nv.offset = -1;
+    layoutDirty_ = true;
+    return nv;
+  }
 
-    virtual void apply(GLint location, GLsizei count, const GLint *boundTexUnit) const {
-      assert(count <= size);
-      _helper::genericGlUniformv(location, count, &vs_[0]);
-    }
-  };
+  // Number of elements of heap_ (or textures_) reserved by `v'
+  static int getHeapSize(const Value& v) {
+    return v.offset < 0 ? 0 : (_helper::isSamplerType(v.type) ? v.size : v.size * _helper::getTypeComponents(v.type));
+  }
 
-  class Matrix4sValue : public Value {
-    // to pass the data into glUniformMatrix4fv, 
-    // we need to have the internal buffer to be typed float.
-    std::vector<glm::mat4> ms_;
-public:
-    Matrix4sValue(const glm::mat4 *m, int size)
-      : Value(GL_FLOAT_MAT4, size), ms_(size) {
-      assert(size > 0);
-      for (int i = 0; i < size; ++i) {
-        ms_[i] = m[i];    // m[i].writeToColumnMajorMatrix(&ms_[i][0]);
-      }
+  Uniforms& putScalars(int id, GLenum type, GLint size, const void *data, size_t bytes) {
+    assert(size > 0);
+    Value& v = getOrInsert(id);
+    if (bytes <= sizeof(v.data)) {
+      v.offset = -1;
+      std::memcpy(v.data.i, data, bytes);
     }
-
-    virtual Value* clone() const {
-      return new Matrix4sValue(*this);
+    else {
+      const int n = (int)(bytes / sizeof(GLint));
+      if (_helper::isSamplerType(v.type) || getHeapSize(v) < n) {
+        v.offset = (int)heap_.size();
+        heap_.resize(heap_.size() + n);
+      }
+      std::memcpy(&heap_[v.offset], data, bytes);
     }
+    if (v.type != type || v.size != size)
+      layoutDirty_ = true;
+    ++changeCount_;
+    v.type = type;
+    v.size = size;
+    return *this;
+  }
 
-    virtual void apply(GLint location, GLsizei count, const GLint *boundTexUnit) const {
-      assert(count <= size);
-      _helper::genericGlUniformMatrix4v(location, count, &ms_[0]);
+  Uniforms& putTextures(int id, const std::shared_ptr<Texture> *tex, int size) {
+    assert(size > 0);
+    const GLenum type = tex[0]->getSamplerType();
+    for (int i = 0; i < size; ++i) {
+      assert(tex[i]->getSamplerType() == type);
     }
-  };
 
-  class TexturesValue : public Value {
-    std::vector<std::shared_ptr<Texture> > texs_;
-public:
-    TexturesValue(const std::shared_ptr<Texture> *tex, int size)
-      : Value(tex[0]->getSamplerType(), size), texs_(tex, tex + size) {
-      assert(size > 0);
-      for (int i = 0; i < size; ++i) {
-        assert(tex[i]->getSamplerType() == type);
-      }
+    Value& v = getOrInsert(id);
+    if (!_helper::isSamplerType(v.type) || getHeapSize(v) < size) {
+      v.offset = (int)textures_.size();
+      textures_.resize(textures_.size() + size);
     }
-
-    virtual Value* clone() const {
-      return new TexturesValue(*this);
+    for (int i = 0; i < size; ++i) {
+      textures_[v.offset + i] = tex[i];
     }
+    if (v.type != type || v.size != size)
+      layoutDirty_ = true;
+    ++changeCount_;
+    v.type = type;
+    v.size = size;
+    return *this;
+  }
 
-    virtual void apply(GLint location, GLsizei count, const GLint *boundTexUnits) const {
-      assert(count <= size);
-      _helper::genericGlUniformv(location, count, boundTexUnits);
-    }
+  // If type is one of GL_SAMPLER_*, getTextures provides a pointer to the array
+  // of shared_ptr<Texture> stored by the uniform, and apply uses the boundTexUnits
+  // argument as the argument for glUniform*.
+  //
+  // Otherwise, boundTexUnit should be ignored and whatever values contained in
+  // the Value instance are set to given location.
+  //
+  // `count' specifies how many actural uniforms are specified by the shader, and
+  // should be used as input parameter to glUniform*
+  const std::shared_ptr<Texture> * getTextures(const Value& v) const {
+    return _helper::isSamplerType(v.type) ? &textures_[v.offset] : NULL;
+  }
 
-    virtual const std::shared_ptr<Texture> *getTextures() const {
-      return &texs_[0];
+  void apply(const Value& v, GLint location, GLsizei count, const GLint *boundTexUnits) const {
+    assert(count <= v.size);
+    const GLint *i = v.offset < 0 ? v.data.i : &heap_[v.offset];
+    const GLfloat *f = reinterpret_cast<const GLfloat*>(i);
+
+    switch (v.type) {
+    case GL_INT: ::glUniform1iv(location, count, i); break;
+    case GL_INT_VEC2: ::glUniform2iv(location, count, i); break;
+    case GL_INT_VEC3: ::glUniform3iv(location, count, i); break;
+    case GL_INT_VEC4: ::glUniform4iv(location, count, i); break;
+    case GL_FLOAT: ::glUniform1fv(location, count, f); break;
+    case GL_FLOAT_VEC2: ::glUniform2fv(location, count, f); break;
+    case GL_FLOAT_VEC3: ::glUniform3fv(location, count, f); break;
+    case GL_FLOAT_VEC4: ::glUniform4fv(location, count, f); break;
+    case GL_FLOAT_MAT4: ::glUniformMatrix4fv(location, count, GL_FALSE, f); break;
+    default:
+      assert(_helper::isSamplerType(v.type));
+      ::glUniform1iv(location, count, boundTexUnits);
     }
-  };
+  }
 };
-